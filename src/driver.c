@@ -1270,6 +1270,9 @@ static Bool CloseScreen(ScreenPtr pScreen)
 	if (pLs->dri2)
 		ARMSOCDRI2CloseScreen(pScreen);
 
+	if (pLs->pARMSOCEXA)
+		LS_PresentScreenFini(pScreen);
+
 	if (pLs->pARMSOCEXA)
 		if (pLs->pARMSOCEXA->CloseScreen)
 			pLs->pARMSOCEXA->CloseScreen(pScreen);
@@ -60,6 +60,8 @@ struct drmmode_rec {
 
         Bool dri2_flipping;
         Bool present_flipping;
+        /* Present flips waiting for the rendering to their pixmap */
+        struct xorg_list present_fence_flips;
         Bool flip_bo_import_failed;
 
         Bool dri2_enable;
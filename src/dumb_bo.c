@@ -380,6 +380,27 @@ int armsoc_bo_cpu_fini(struct dumb_bo *bo)
     return msync(bo->ptr, bo->size, MS_SYNC | MS_INVALIDATE);
 }
 
+/* whole rows y1 to y2 only, from the page holding row y1 */
+int armsoc_bo_cpu_fini_region(struct dumb_bo *bo, int y1, int y2)
+{
+    uintptr_t page_mask = ~((uintptr_t)getpagesize() - 1);
+    uintptr_t start, end;
+
+    assert(bo->refcnt > 0);
+
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 > (int)bo->height)
+        y2 = bo->height;
+    if (y1 >= y2)
+        return 0;
+
+    start = ((uintptr_t)bo->ptr + (uintptr_t)y1 * bo->pitch) & page_mask;
+    end = (uintptr_t)bo->ptr + (uintptr_t)y2 * bo->pitch;
+
+    return msync((void *)start, end - start, MS_SYNC | MS_INVALIDATE);
+}
+
 
 int armsoc_bo_add_fb(struct dumb_bo *bo)
 {
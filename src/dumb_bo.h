@@ -101,6 +101,7 @@ int armsoc_bo_to_dmabuf(struct dumb_bo *bo, int * pPrimeFD);
 // ?
 int armsoc_bo_cpu_prep(struct dumb_bo *bo);
 int armsoc_bo_cpu_fini(struct dumb_bo *bo);
+int armsoc_bo_cpu_fini_region(struct dumb_bo *bo, int y1, int y2);
 
 
 #endif
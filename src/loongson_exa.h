@@ -48,6 +48,7 @@ struct ARMSOCEXABuf {
 	size_t size;
 	int pitch;
 	void *priv;
+	int flags; // sub-module flags priv was created with, e.g. ETNA_BO_*
 };
 
 /**
@@ -92,6 +93,13 @@ struct ARMSOCEXARec {
 	 */
 	void (*FreeScreen)(ScrnInfoPtr arg);
 
+	/**
+	 * Submit the pending rendering to a pixmap without waiting for it.
+	 * Returns a sync_file fd signaled once it is done, or -1 if there
+	 * is nothing to wait for. Optional, the caller owns the fd.
+	 */
+	int (*FlushFence)(struct ARMSOCEXARec *exa, PixmapPtr pPixmap);
+
 	/* add new fields here at end, to preserve ABI */
 };
 
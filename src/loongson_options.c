@@ -40,6 +40,8 @@ static const OptionInfoRec Options[] = {
     { OPTION_DRI_NUM_BUF, "DRI2MaxBuffers",   OPTV_INTEGER, {-1},  FALSE },
     { OPTION_DRIVERNAME,  "KernelDriverName", OPTV_STRING,  {0},   FALSE },
     { OPTION_SOFT_EXA,    "SoftEXA",          OPTV_BOOLEAN, {0},   FALSE },
+    { OPTION_MIGRATE_TO_CPU, "MigrateToCPU",  OPTV_INTEGER, {-1},  FALSE },
+    { OPTION_MIGRATE_TO_GPU, "MigrateToGPU",  OPTV_INTEGER, {-1},  FALSE },
     { -1,                 NULL,               OPTV_NONE,    {0},   FALSE }
 };
 
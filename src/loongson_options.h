@@ -11,6 +11,8 @@ enum {
         OPTION_DRI_NUM_BUF,
         OPTION_DRIVERNAME,
         OPTION_SOFT_EXA,
+        OPTION_MIGRATE_TO_CPU,
+        OPTION_MIGRATE_TO_GPU,
 } loongsonOpts;
 
 
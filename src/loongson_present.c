@@ -358,6 +358,10 @@ static void ms_present_flush(WindowPtr window)
 	struct ARMSOCRec * pLS = loongsonPTR(scrn);
 
 	ARMSOC_PRESENT_DBG_MSG("ms_present_flush");
+
+	// submit the rendering to the window, never wait for it here
+	if (pLS->pARMSOCEXA && pLS->pARMSOCEXA->Flush)
+		pLS->pARMSOCEXA->Flush(pLS->pARMSOCEXA);
 }
 
 
@@ -462,6 +466,60 @@ static Bool ms_present_check_flip(RRCrtcPtr crtc,
  * present_event_notify should be called with 'event_id' when the flip
  * occurs
  */
+/*
+ * A flip waiting for the rendering to its pixmap, queued behind the
+ * sync_file fd of that rendering instead of blocking the server on it.
+ */
+struct ms_present_fence_flip {
+    struct xorg_list link; /* in drmmode.present_fence_flips */
+    ScreenPtr screen;
+    PixmapPtr pixmap;
+    int fence_fd;
+    uint64_t event_id;
+    uint32_t fb_id;
+    Bool sync_flip;
+};
+
+static void ms_present_fence_flip_drop(struct ms_present_fence_flip *flip)
+{
+    xorg_list_del(&flip->link);
+    RemoveNotifyFd(flip->fence_fd);
+    close(flip->fence_fd);
+    flip->screen->DestroyPixmap(flip->pixmap);
+    free(flip);
+}
+
+/* forget the flips still waiting, their pixmaps must not reach the screen */
+static void ms_present_fence_flips_drop(struct ARMSOCRec *pLS)
+{
+    struct ms_present_fence_flip *flip, *tmp;
+
+    xorg_list_for_each_entry_safe(flip, tmp,
+            &pLS->drmmode.present_fence_flips, link)
+        ms_present_fence_flip_drop(flip);
+}
+
+static void ms_present_fence_flip_notify(int fd, int notify, void *data)
+{
+    struct ms_present_fence_flip *flip = data;
+    ScreenPtr screen = flip->screen;
+    ScrnInfoPtr scrn = xf86ScreenToScrn(screen);
+    struct ARMSOCRec * pLS = loongsonPTR(scrn);
+
+    ARMSOC_PRESENT_DBG_MSG("present_flip fence signaled");
+
+    // drmmode_page_flip() returns the number of crtcs flipped, negative on failure
+    if (drmmode_page_flip(screen, &flip->pixmap->drawable,
+            flip->fb_id, flip->sync_flip, NULL) <= 0) {
+        xf86DrvMsg(scrn->scrnIndex, X_ERROR, "present flip failed\n");
+        // present was told the flip is queued, complete its event
+        present_event_notify(flip->event_id, 0, 0);
+        pLS->drmmode.present_flipping = FALSE;
+    }
+
+    ms_present_fence_flip_drop(flip);
+}
+
 static Bool ms_present_flip(RRCrtcPtr crtc,
                             uint64_t event_id,
                             uint64_t target_msc,
@@ -474,6 +532,7 @@ static Bool ms_present_flip(RRCrtcPtr crtc,
     xf86CrtcPtr xf86_crtc = crtc->devPrivate;
     struct drmmode_crtc_private_rec * drmmode_crtc = xf86_crtc->driver_private;
     Bool ret;
+    int fence_fd = -1;
     struct armsoc_present_vblank_event *event;
 
     ARMSOC_PRESENT_DBG_MSG("present_flip");
@@ -491,8 +550,40 @@ static Bool ms_present_flip(RRCrtcPtr crtc,
     event->event_id = event_id;
     event->unflip = FALSE;
 
+    // the legacy flip ioctl takes no in-fence, flip once the gpu
+    // rendering to the pixmap signals its fence
+    if (pLS->pARMSOCEXA && pLS->pARMSOCEXA->FlushFence)
+        fence_fd = pLS->pARMSOCEXA->FlushFence(pLS->pARMSOCEXA, pixmap);
+
+    if (fence_fd >= 0) {
+        struct ms_present_fence_flip *flip = calloc(1, sizeof(*flip));
+
+        if (flip) {
+            flip->screen = screen;
+            flip->pixmap = pixmap;
+            flip->fence_fd = fence_fd;
+            flip->event_id = event_id;
+            flip->fb_id = drmmode_crtc->drmmode->fb_id;
+            flip->sync_flip = sync_flip;
+
+            if (SetNotifyFd(fence_fd, ms_present_fence_flip_notify,
+                    X_NOTIFY_READ, flip)) {
+                pixmap->refcnt++;
+                xorg_list_append(&flip->link,
+                        &pLS->drmmode.present_fence_flips);
+                pLS->drmmode.present_flipping = TRUE;
+                free(event);
+                return TRUE;
+            }
+
+            free(flip);
+        }
+
+        close(fence_fd);
+    }
+
     ret = drmmode_page_flip(screen, &pixmap->drawable,
-        drmmode_crtc->drmmode->fb_id, sync_flip, NULL);
+        drmmode_crtc->drmmode->fb_id, sync_flip, NULL) > 0;
 
     if (!ret)
         xf86DrvMsg(scrn->scrnIndex, X_ERROR, "present flip failed\n");
@@ -518,6 +609,9 @@ static void ms_present_unflip(ScreenPtr screen, uint64_t event_id)
 
     ARMSOC_PRESENT_DBG_MSG("present_unflip");
 
+	// a flip still waiting on its fence would put the client pixmap back
+	ms_present_fence_flips_drop(pLs);
+
 	event = calloc(1, sizeof(struct armsoc_present_vblank_event));
 	if (!event)
 		return;
@@ -587,6 +681,8 @@ Bool LS_PresentScreenInit(ScreenPtr screen)
     uint64_t value;
     int ret;
 
+    xorg_list_init(&pLs->drmmode.present_fence_flips);
+
     ls_vblank_screen_init(screen);
 
     ret = drmGetCap(pLs->drmFD, DRM_CAP_ASYNC_PAGE_FLIP, &value);
@@ -600,3 +696,14 @@ Bool LS_PresentScreenInit(ScreenPtr screen)
 
     return present_screen_init(screen, &loongson_present_screen_info);
 }
+
+
+void LS_PresentScreenFini(ScreenPtr screen)
+{
+#if LOONGSON_PRESENT_FLIP
+    ScrnInfoPtr scrn = xf86ScreenToScrn(screen);
+    struct ARMSOCRec * pLs = loongsonPTR(scrn);
+
+    ms_present_fence_flips_drop(pLs);
+#endif
+}
@@ -10,4 +10,5 @@ Bool ms_crtc_on(xf86CrtcPtr crtc);
 
 // Present
 Bool LS_PresentScreenInit(ScreenPtr screen);
+void LS_PresentScreenFini(ScreenPtr screen);
 #endif
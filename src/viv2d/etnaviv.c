@@ -470,7 +470,7 @@ static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
 	}
 
 	if (out_fence_fd)
-		*out_fence_fd = req.fence_fd;
+		*out_fence_fd = ret ? -1 : req.fence_fd;
 }
 
 void etna_cmd_stream_flush(struct etna_cmd_stream *stream)
@@ -8,6 +8,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <string.h>
 
 #include <xorg-server.h>
 #include <xf86.h>
@@ -26,10 +27,16 @@ static queue_t *unused_bos;
 
 #define ALIGN(v,a) (((v) + (a) - 1) & ~((a) - 1))
 
+#define VOID2U64(x) ((uint64_t)(unsigned long)(x))
+
 #define INFO_MSG(fmt, ...) \
 		do { xf86Msg(X_INFO, fmt "\n",\
 				##__VA_ARGS__); } while (0)
 
+#define ERROR_MSG(fmt, ...) \
+		do { xf86Msg(X_ERROR, fmt "\n",\
+				##__VA_ARGS__); } while (0)
+
 #ifdef ETNA_BO_CACHE_DEBUG
 #define CACHE_DEBUG_MSG(fmt, ...) \
 		do { xf86Msg(X_INFO, fmt "\n",\
@@ -66,7 +73,9 @@ void etna_bo_cache_usermem_del(struct etna_device *dev, struct etna_bo *bo) {
 	queue_push_tail(dev->cache->usermem_bos, bo);
 	pthread_mutex_unlock(&cache_lock);
 #else
-//	queue_push_tail(unused_bos, bo);
+	// the kernel keeps the pages pinned while submitted work uses them,
+	// only the streams being built have to be done with it
+	etna_bo_cache_del(dev, bo);
 #endif
 }
 
@@ -147,6 +156,12 @@ struct etna_bo *etna_bo_cache_new(struct etna_device *dev, size_t size, int flag
 
 void etna_bo_cache_del(struct etna_device *dev, struct etna_bo *bo) {
 #ifdef ETNAVIV_CUSTOM
+	// buckets only hand out wc bos, cached ones are deleted once idle
+	if (bo->flags & ETNA_BO_CACHED) {
+		etna_bo_cache_usermem_del(dev, bo);
+		return;
+	}
+
 	struct etna_bo_cache *cache = dev->cache;
 	size_t aligned_bo_size = ALIGN(bo->size, ETNA_BO_CACHE_PAGE_SIZE);
 	uint16_t bucket_size = ETNA_BO_CACHE_BUCKET_FROM_SIZE(aligned_bo_size);
@@ -172,7 +187,7 @@ int etna_bo_cache_clean_bucket(struct etna_device *dev, struct etna_bo_cache_buc
 	uint32_t qsize = queue_size(bucket->unused_bos);
 	for (int i = 0; i < qsize; ++i) {
 		struct etna_bo *unused_bo = queue_peek_head(bucket->unused_bos);
-		if (unused_bo->state == ETNA_BO_READY) { // bos are really free when they are ready
+		if (etna_bo_idle(unused_bo, ETNA_PREP_WRITE)) { // bos are really free when the gpu is done with them
 			CACHE_DEBUG_MSG("etna_bo_cache_clean_bucket: remove bo:%p bo_size:%d", unused_bo, unused_bo->size);
 			unused_bo = queue_pop_head(bucket->unused_bos);
 			queue_push_tail(bucket->free_bos, unused_bo);
@@ -233,11 +248,11 @@ void etna_bo_cache_clean(struct etna_device *dev) {
 
 	while (!queue_is_empty(cache->usermem_bos)) {
 		struct etna_bo *bo = queue_peek_head(cache->usermem_bos);
-		if (bo->state == ETNA_BO_READY) { // bos are really free when they are ready
-			bo = queue_pop_head(cache->usermem_bos);
-			CACHE_DEBUG_MSG("etna_bo_cache_clean: delete usermem bo:%p", bo);
-			etna_bo_del(bo);
-		}
+		if (!etna_bo_idle(bo, ETNA_PREP_WRITE)) // retire in order, keep the rest for next clean
+			break;
+		bo = queue_pop_head(cache->usermem_bos);
+		CACHE_DEBUG_MSG("etna_bo_cache_clean: delete usermem bo:%p", bo);
+		etna_bo_del(bo);
 	}
 
 	pthread_mutex_unlock(&cache_lock);
@@ -289,14 +304,416 @@ void etna_bo_unmap(struct etna_bo *bo) {
 
 }
 
-int etna_bo_ready(struct etna_bo *bo) {
+// grow the buffer of stream to size words, keeping what was emitted.
+// the buffer is malloc'ed by etna_cmd_stream_new and freed by etna_cmd_stream_del
+int etna_cmd_stream_grow(struct etna_cmd_stream *stream, uint32_t size) {
+	uint32_t *buffer;
+
+	if (size <= stream->size)
+		return 0;
+
+	buffer = realloc(stream->buffer, size * sizeof(uint32_t));
+	if (!buffer)
+		return -ENOMEM;
+
+	stream->buffer = buffer;
+	stream->size = size;
+	return 0;
+}
+
+#ifndef ETNAVIV_CUSTOM
+// libdrm_etnaviv's bo2idx() takes a global lock on every reloc and scans the
+// stream bos when the bo was last used in another stream. streams created
+// here have their relocs resolved through a per stream open addressed table
+// from bo handle to index instead, kept in the reset_notify private data.
+// the submit tables stay the libdrm ones, so does the flush
+
+#define ETNA_BO_HASH_MIN_SIZE 64
+
+struct etna_bo_hash {
+	uint32_t *slots; // bo idx + 1, 0 is an empty slot
+	uint32_t size; // power of two
+	uint32_t nr_slow_lookups; // lookups not served by bo->current_stream
+};
+
+static inline struct etna_cmd_stream_priv *
+etna_cmd_stream_priv(struct etna_cmd_stream *stream)
+{
+	return (struct etna_cmd_stream_priv *)stream;
+}
+
+static void *grow(void *ptr, uint32_t nr, uint32_t *max, uint32_t sz)
+{
+	if ((nr + 1) > *max) {
+		if ((*max * 2) < (nr + 1))
+			*max = nr + 5;
+		else
+			*max = *max * 2;
+		ptr = realloc(ptr, *max * sz);
+	}
+
+	return ptr;
+}
+
+#define APPEND(x, name) ({ \
+	(x)->name = grow((x)->name, (x)->nr_ ## name, &(x)->max_ ## name, sizeof((x)->name[0])); \
+	(x)->nr_ ## name ++; \
+})
+
+static inline uint32_t etna_bo_hash_slot(struct etna_bo_hash *hash, uint32_t handle) {
+	// fibonacci hashing, handles are small sequential integers
+	return (handle * 2654435761u) & (hash->size - 1);
+}
+
+static void etna_bo_hash_insert(struct etna_bo_hash *hash, uint32_t handle, uint32_t idx) {
+	uint32_t slot = etna_bo_hash_slot(hash, handle);
+
+	while (hash->slots[slot])
+		slot = (slot + 1) & (hash->size - 1);
+
+	hash->slots[slot] = idx + 1;
+}
+
+// double the table and insert the stream bos again
+static int etna_bo_hash_grow(struct etna_bo_hash *hash, struct etna_cmd_stream_priv *priv) {
+	uint32_t size = hash->size * 2;
+	uint32_t *slots = calloc(size, sizeof(uint32_t));
+
+	if (!slots)
+		return -ENOMEM;
+
+	free(hash->slots);
+	hash->slots = slots;
+	hash->size = size;
+
+	for (uint32_t i = 0; i < priv->nr_bos; i++)
+		etna_bo_hash_insert(hash, priv->bos[i]->handle, i);
+
+	return 0;
+}
+
+static void etna_bo_hash_reset(struct etna_cmd_stream *stream, void *data) {
+	struct etna_bo_hash *hash = data;
+
+	memset(hash->slots, 0, hash->size * sizeof(uint32_t));
+}
+
+static uint32_t etna_cmd_stream_append_bo(struct etna_cmd_stream *stream, struct etna_bo *bo) {
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	struct etna_bo_hash *hash = priv->reset_notify_priv;
+	uint32_t idx;
+
+	idx = APPEND(&priv->submit, bos);
+	idx = APPEND(priv, bos);
+
+	priv->submit.bos[idx].flags = 0;
+	priv->submit.bos[idx].handle = bo->handle;
+
+	// dropped by the flush
+	priv->bos[idx] = etna_bo_ref(bo);
+
+	// keep the table at most half full
+	if (priv->nr_bos * 2 > hash->size && etna_bo_hash_grow(hash, priv) == 0)
+		return idx; // the rehash inserted it
+
+	// never fill the table, a failed grow only costs duplicate entries
+	if (priv->nr_bos < hash->size)
+		etna_bo_hash_insert(hash, bo->handle, idx);
+
+	return idx;
+}
+
+static uint32_t etna_cmd_stream_bo2idx(struct etna_cmd_stream *stream, struct etna_bo *bo, uint32_t flags) {
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	struct etna_bo_hash *hash = priv->reset_notify_priv;
+	uint32_t idx;
+
+	if (bo->current_stream == stream) {
+		idx = bo->idx;
+	} else {
+		uint32_t slot = etna_bo_hash_slot(hash, bo->handle);
+		uint32_t entry;
+
+		hash->nr_slow_lookups++;
+
+		while ((entry = hash->slots[slot])) {
+			if (priv->bos[entry - 1] == bo)
+				break;
+			slot = (slot + 1) & (hash->size - 1);
+		}
+
+		if (entry)
+			idx = entry - 1;
+		else
+			idx = etna_cmd_stream_append_bo(stream, bo);
+
+		bo->current_stream = stream;
+		bo->idx = idx;
+	}
+
+	if (flags & ETNA_RELOC_READ)
+		priv->submit.bos[idx].flags |= ETNA_SUBMIT_BO_READ;
+	if (flags & ETNA_RELOC_WRITE)
+		priv->submit.bos[idx].flags |= ETNA_SUBMIT_BO_WRITE;
+
+	return idx;
+}
+#endif
+
+struct etna_cmd_stream *etna_cmd_stream_new_hashed(struct etna_pipe *pipe, uint32_t size) {
 #ifdef ETNAVIV_CUSTOM
-	return (bo->state == ETNA_BO_READY);
+	return etna_cmd_stream_new(pipe, size, NULL, NULL);
 #else
-	return (bo->current_stream == NULL);
+	struct etna_bo_hash *hash = calloc(1, sizeof(*hash));
+	struct etna_cmd_stream *stream;
+
+	if (!hash)
+		return NULL;
+
+	hash->size = ETNA_BO_HASH_MIN_SIZE;
+	hash->slots = calloc(hash->size, sizeof(uint32_t));
+	if (!hash->slots) {
+		free(hash);
+		return NULL;
+	}
+
+	stream = etna_cmd_stream_new(pipe, size, etna_bo_hash_reset, hash);
+	if (!stream) {
+		free(hash->slots);
+		free(hash);
+	}
+	return stream;
 #endif
 }
 
+void etna_cmd_stream_del_hashed(struct etna_cmd_stream *stream) {
+#ifndef ETNAVIV_CUSTOM
+	struct etna_bo_hash *hash = etna_cmd_stream_priv(stream)->reset_notify_priv;
+
+	free(hash->slots);
+	free(hash);
+#endif
+	etna_cmd_stream_del(stream);
+}
+
+void etna_cmd_stream_reloc_hashed(struct etna_cmd_stream *stream, const struct etna_reloc *r) {
+#ifdef ETNAVIV_CUSTOM
+	etna_cmd_stream_reloc(stream, r);
+#else
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+	struct drm_etnaviv_gem_submit_reloc *reloc;
+	uint32_t idx = APPEND(&priv->submit, relocs);
+
+	reloc = &priv->submit.relocs[idx];
+	reloc->reloc_idx = etna_cmd_stream_bo2idx(stream, r->bo, r->flags);
+	reloc->reloc_offset = r->offset;
+	reloc->submit_offset = stream->offset * 4; // in bytes
+	reloc->flags = 0;
+
+	etna_cmd_stream_emit(stream, 0); // patched by the kernel
+#endif
+}
+
+uint32_t etna_cmd_stream_slow_lookups(struct etna_cmd_stream *stream) {
+#ifdef ETNAVIV_CUSTOM
+	return 0;
+#else
+	struct etna_bo_hash *hash = etna_cmd_stream_priv(stream)->reset_notify_priv;
+
+	return hash->nr_slow_lookups;
+#endif
+}
+
+#ifndef ETNAVIV_CUSTOM
+// libdrm_etnaviv keeps no fences per bo and its etna_bo is not ours to extend:
+// the fences of the last gpu read and write of each bo submitted through
+// etna_cmd_stream_submit() are kept in a table indexed by gem handle. a
+// handle reused by a new bo inherits stale fences, it only looks busy
+// until they retire
+
+struct etna_bo_fences {
+	uint32_t read;
+	uint32_t write;
+};
+
+static struct etna_bo_fences *bo_fences;
+static uint32_t nr_bo_fences;
+static struct etna_pipe *fence_pipe; // pipe of the recorded fences
+static uint32_t completed_fence; // last fence known to be retired
+
+// fences wrap around, compare them as a signed distance
+static inline int etna_fence_passed(uint32_t completed, uint32_t fence) {
+	return (int32_t)(completed - fence) >= 0;
+}
+
+// non blocking, true when the gpu is done with fence
+static int etna_fence_retired(uint32_t fence) {
+	struct drm_etnaviv_wait_fence req = {
+		.fence = fence,
+		.flags = ETNA_WAIT_NONBLOCK,
+	};
+
+	if (etna_fence_passed(completed_fence, fence))
+		return 1;
+
+	req.pipe = fence_pipe->gpu->core;
+	if (drmCommandWrite(fence_pipe->gpu->dev->fd, DRM_ETNAVIV_WAIT_FENCE, &req, sizeof(req)))
+		return 0; // -EBUSY, or not known to be done
+
+	// fences retire in order
+	completed_fence = fence;
+	return 1;
+}
+
+static void etna_bo_fences_record(struct etna_cmd_stream_priv *priv, uint32_t fence) {
+	fence_pipe = priv->pipe;
+
+	for (uint32_t i = 0; i < priv->submit.nr_bos; i++) {
+		struct drm_etnaviv_gem_submit_bo *sbo = &priv->submit.bos[i];
+
+		if (sbo->handle >= nr_bo_fences) {
+			uint32_t nr = nr_bo_fences ? nr_bo_fences : 256;
+			struct etna_bo_fences *fences;
+
+			while (nr <= sbo->handle)
+				nr *= 2;
+
+			// on failure the bo is left to etna_bo_cpu_prep()
+			fences = realloc(bo_fences, nr * sizeof(*fences));
+			if (!fences)
+				continue;
+			memset(fences + nr_bo_fences, 0, (nr - nr_bo_fences) * sizeof(*fences));
+			bo_fences = fences;
+			nr_bo_fences = nr;
+		}
+
+		if (sbo->flags & ETNA_SUBMIT_BO_READ)
+			bo_fences[sbo->handle].read = fence;
+		if (sbo->flags & ETNA_SUBMIT_BO_WRITE)
+			bo_fences[sbo->handle].write = fence;
+	}
+}
+#endif
+
+#ifndef ETNAVIV_CUSTOM
+// a submit is split in three so the ioctl can run on another thread: the
+// request is prepared and completed on the thread building the streams,
+// which owns the bos and the stream bookkeeping, only the ioctl in between
+// may run elsewhere. the stream must not be touched until it is done
+
+void etna_cmd_stream_submit_prepare(struct etna_cmd_stream *stream,
+		struct drm_etnaviv_gem_submit *req, int out_fence) {
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	*req = (struct drm_etnaviv_gem_submit) {
+		.pipe = priv->pipe->gpu->core,
+		.exec_state = priv->pipe->id,
+		.bos = VOID2U64(priv->submit.bos),
+		.nr_bos = priv->submit.nr_bos,
+		.relocs = VOID2U64(priv->submit.relocs),
+		.nr_relocs = priv->submit.nr_relocs,
+		.pmrs = VOID2U64(priv->submit.pmrs),
+		.nr_pmrs = priv->submit.nr_pmrs,
+		.stream = VOID2U64(stream->buffer),
+		.stream_size = stream->offset * 4, // in bytes
+	};
+
+	if (out_fence)
+		req->flags |= ETNA_SUBMIT_FENCE_FD_OUT;
+}
+
+// any thread, only reads the device of stream
+int etna_cmd_stream_submit_ioctl(struct etna_cmd_stream *stream,
+		struct drm_etnaviv_gem_submit *req) {
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	return drmCommandWriteRead(priv->pipe->gpu->dev->fd, DRM_ETNAVIV_GEM_SUBMIT,
+	                           req, sizeof(*req));
+}
+
+// ret is the result of the ioctl, req->fence_fd is only valid without error
+void etna_cmd_stream_submit_done(struct etna_cmd_stream *stream,
+		struct drm_etnaviv_gem_submit *req, int ret) {
+	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
+
+	if (ret) {
+		ERROR_MSG("etna_cmd_stream_submit: submit failed: %d (%s)", ret, strerror(-ret));
+	} else {
+		priv->last_timestamp = req->fence;
+		etna_bo_fences_record(priv, req->fence);
+	}
+
+	for (uint32_t i = 0; i < priv->nr_bos; i++) {
+		struct etna_bo *bo = priv->bos[i];
+
+		// the bo may already be referenced by the stream being built
+		if (bo->current_stream == stream)
+			bo->current_stream = NULL;
+		etna_bo_del(bo);
+	}
+
+	stream->offset = 0;
+	priv->submit.nr_bos = 0;
+	priv->submit.nr_relocs = 0;
+	priv->submit.nr_pmrs = 0;
+	priv->nr_bos = 0;
+
+	if (priv->reset_notify)
+		priv->reset_notify(stream, priv->reset_notify_priv);
+}
+#endif
+
+// submit stream and reset it, with out_fence_fd also get a sync_file fd
+// signaled once the gpu is done with it (-1 on failure)
+void etna_cmd_stream_submit(struct etna_cmd_stream *stream, int *out_fence_fd) {
+#ifdef ETNAVIV_CUSTOM
+	if (out_fence_fd)
+		etna_cmd_stream_flush2(stream, -1, out_fence_fd);
+	else
+		etna_cmd_stream_flush(stream);
+#else
+	struct drm_etnaviv_gem_submit req;
+	int ret;
+
+	etna_cmd_stream_submit_prepare(stream, &req, out_fence_fd != NULL);
+	ret = etna_cmd_stream_submit_ioctl(stream, &req);
+	etna_cmd_stream_submit_done(stream, &req, ret);
+
+	if (out_fence_fd)
+		*out_fence_fd = ret ? -1 : req.fence_fd;
+#endif
+}
+
+// non blocking, true when no submitted gpu access conflicts with op
+int etna_bo_idle(struct etna_bo *bo, uint32_t op) {
+	if (bo->current_stream)
+		return 0; // referenced by a stream not submitted yet
+
+#ifndef ETNAVIV_CUSTOM
+	if (bo->handle < nr_bo_fences) {
+		struct etna_bo_fences *fences = &bo_fences[bo->handle];
+		uint32_t fence = fences->write;
+
+		// cpu reads only wait for gpu writes, cpu writes wait for both
+		if ((op & ETNA_PREP_WRITE) && !etna_fence_passed(fence, fences->read))
+			fence = fences->read;
+
+		return etna_fence_retired(fence);
+	}
+#endif
+
+	// not submitted by us, ask the kernel without waiting
+	if (etna_bo_cpu_prep(bo, op | ETNA_PREP_NOSYNC))
+		return 0; // -EBUSY, the gpu still uses it
+
+	etna_bo_cpu_fini(bo);
+	return 1;
+}
+
+int etna_bo_ready(struct etna_bo *bo) {
+	return etna_bo_idle(bo, ETNA_PREP_WRITE);
+}
+
 int etna_bo_wait(struct etna_device *dev, struct etna_pipe *pipe, struct etna_bo *bo, uint64_t ns) {
 #ifdef ETNAVIV_CUSTOM
 	int err;
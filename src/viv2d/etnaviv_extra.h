@@ -47,7 +47,21 @@ void etna_bo_cache_usermem_del(struct etna_device *dev, struct etna_bo *bo);
 // extra
 
 void etna_nop(struct etna_cmd_stream *stream);
+int etna_cmd_stream_grow(struct etna_cmd_stream *stream, uint32_t size);
+// streams resolving their relocs through a bo handle hash, no global lock
+struct etna_cmd_stream *etna_cmd_stream_new_hashed(struct etna_pipe *pipe, uint32_t size);
+void etna_cmd_stream_del_hashed(struct etna_cmd_stream *stream);
+void etna_cmd_stream_reloc_hashed(struct etna_cmd_stream *stream, const struct etna_reloc *r);
+uint32_t etna_cmd_stream_slow_lookups(struct etna_cmd_stream *stream);
+void etna_cmd_stream_submit(struct etna_cmd_stream *stream, int *out_fence_fd);
+#ifndef ETNAVIV_CUSTOM
+struct drm_etnaviv_gem_submit;
+void etna_cmd_stream_submit_prepare(struct etna_cmd_stream *stream, struct drm_etnaviv_gem_submit *req, int out_fence);
+int etna_cmd_stream_submit_ioctl(struct etna_cmd_stream *stream, struct drm_etnaviv_gem_submit *req);
+void etna_cmd_stream_submit_done(struct etna_cmd_stream *stream, struct drm_etnaviv_gem_submit *req, int ret);
+#endif
 int etna_bo_ready(struct etna_bo *bo);
+int etna_bo_idle(struct etna_bo *bo, uint32_t op); // non blocking, no gpu access conflicting with op pending
 int etna_bo_wait(struct etna_device *dev, struct etna_pipe *pipe, struct etna_bo *bo, uint64_t ns);
 struct etna_bo *etna_bo_from_usermem_prot(struct etna_device *dev, void *memory, size_t size, int flags);
 
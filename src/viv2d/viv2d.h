@@ -12,6 +12,14 @@
 
 #include "viv2d_config.h"
 
+#ifdef VIV2D_GRADIENT
+#include "picturestr.h"
+#endif
+
+#ifdef VIV2D_ACCESS_REGION
+#include "damage.h"
+#endif
+
 #define ALIGN(val, align)	(((val) + (align) - 1) & ~((align) - 1))
 
 #ifdef VIV2D_DEBUG
@@ -65,6 +73,9 @@
 #define ROP_DST_OR_SRC 			0xee
 #define ROP_WHITE 				0xff
 
+// chipMinorFeatures4 (ETNA_GPU_FEATURES_5) bit: 2D engine supports A8 target
+#define VIV2D_MINOR_FEATURES4_2D_A8_TARGET	0x20000000
+
 typedef struct _Viv2DRect {
 	int x1;
 	int y1;
@@ -97,8 +108,80 @@ typedef struct {
 
 	struct ARMSOCPixmapPrivRec *armsocPix; // armsoc pixmap ref
 	int refcnt;
+	uint32_t batch; // serial of the last batch referencing bo
+	uint32_t offset; // of the pixmap in bo, non zero in a glyph atlas
+#ifdef VIV2D_SOLID_CACHE
+	// pixel value of the whole pixmap, set when read back or solid
+	// filled, dropped on any gpu or cpu write
+	Bool solid_known;
+	Pixel solid;
+#endif
+#ifdef VIV2D_CACHED_PIXMAPS
+	// recent accesses, halved past VIV2D_CACHED_WINDOW
+	uint16_t gpu_ops;
+	uint16_t cpu_reads;
+	uint16_t cpu_writes;
+	Bool cached; // ETNA_BO_CACHED bo, every cpu access goes through prep/fini
+#endif
+#ifdef VIV2D_PLACEMENT
+	uint16_t gpu_misses; // gpu ops refused for lack of a bo, aged with the above
+#endif
+#ifdef VIV2D_ACCESS_REGION
+	// drawing to a dumb pixmap since its last cpu access flush, pixmap coordinates
+	DamagePtr damage;
+	BoxRec damage_box; // empty when x1 >= x2
+#endif
 } Viv2DPixmapPrivRec, *Viv2DPixmapPrivPtr;
 
+// a bo glyph pictures of one bpp are carved from, shelf packed. space is
+// only reclaimed once every glyph of the atlas is freed
+typedef struct _Viv2DAtlas {
+	struct etna_bo *bo;
+	uint8_t *map;
+	int bpp;
+	int x; // in bytes
+	int y;
+	int shelf;
+	int used; // glyphs alive
+} Viv2DAtlas;
+
+#ifdef VIV2D_UPLOAD_TO_SCREEN
+// persistent bo uploads are copied into, packed one after the other
+// until full, then the next one of the ring is used once the gpu is done
+typedef struct _Viv2DStaging {
+	struct etna_bo *bo;
+	uint8_t *map;
+	uint32_t used; // in bytes
+} Viv2DStaging;
+#endif
+
+#ifdef VIV2D_USERPTR
+// client memory imported for an upload, later uploads inside it reuse it
+typedef struct _Viv2DUserptr {
+	struct etna_bo *bo;
+	uintptr_t start;
+	size_t size;
+	uint32_t stamp; // last use, 0 when the slot is free
+} Viv2DUserptr;
+#endif
+
+#ifdef VIV2D_GRADIENT
+// 1-D rasterization of a linear gradient along its axis, picture coordinates
+// start to start + len. premultiplied a8r8g8b8, len x 1 or 1 x len
+typedef struct _Viv2DGradientStrip {
+	uint32_t stamp; // last use, 0 when the slot is free
+	Bool vertical;
+	int repeat;
+	xPointFixed p1;
+	xPointFixed p2;
+	int nstops;
+	PictGradientStop *stops;
+	int start;
+	int len;
+	Viv2DPixmapPrivPtr pix;
+} Viv2DGradientStrip;
+#endif
+
 typedef struct _Viv2DBlendOp {
 	int op;
 	int src_blend_mode;
@@ -112,6 +195,16 @@ enum viv2d_src_type {
 	viv2d_src_brush_fill
 };
 
+// a masked composite rect, waiting for its three passes
+typedef struct _Viv2DMaskRect {
+	int src_x;
+	int src_y;
+	int msk_x;
+	int msk_y;
+	Viv2DRect tmp; // packed in the op scratch
+	Viv2DRect dst;
+} Viv2DMaskRect;
+
 typedef struct _Viv2DOp {
 	Viv2DBlendOp *blend_op;
 
@@ -124,6 +217,22 @@ typedef struct _Viv2DOp {
 	uint32_t fg;
 	uint32_t mask;
 
+	// Solid with a partial planemask: dst = (dst & and_color) ^ xor_color
+	Bool solid_and_xor;
+	uint32_t and_color;
+	uint32_t xor_color;
+
+	// A8 Solid without an A8 target: 32bpp view of a8_dst
+	Viv2DPixmapPrivPtr a8_dst;
+	Viv2DPixmapPrivRec a8_view;
+
+#ifdef VIV2D_SOLID_CACHE
+	// plain Solid: dst ends up solid_pixel once solid_cover
+	Bool solid_cache;
+	Bool solid_cover;
+	Pixel solid_pixel;
+#endif
+
 	uint8_t msk_alpha;
 	uint8_t src_alpha;
 	uint8_t dst_alpha;
@@ -138,6 +247,19 @@ typedef struct _Viv2DOp {
 
 	Viv2DPixmapPrivPtr tmp;
 
+	// RepeatNormal tile sizes, 0 when not repeating
+	int src_tile_w;
+	int src_tile_h;
+	int msk_tile_w;
+	int msk_tile_h;
+	Viv2DPixmapPrivPtr tile; // small src tile expanded for the op
+
+	// scale transformed src, read at the translation in the scaled copy
+	Bool src_transform;
+	int src_off_x;
+	int src_off_y;
+	Viv2DPixmapPrivPtr scaled; // src scaled to dst space for the op
+
 	Viv2DFormat msk_fmt;
 	Viv2DFormat src_fmt;
 
@@ -146,19 +268,125 @@ typedef struct _Viv2DOp {
 	int prev_width;
 	int prev_height;
 	int cur_rect;
-	Viv2DRect rects[VIV2D_MAX_RECTS];
+	int max_rects;
+	Viv2DRect *rects;
+
+	// masked composite batch, shelf packed into tmp
+	int cur_mrect;
+	int max_mrects;
+	Viv2DMaskRect *mrects;
+	int tmp_x;
+	int tmp_y;
+	int tmp_shelf;
 
 } Viv2DOp;
 
+// shadow of the last DE state emitted into the current stream
+enum viv2d_state_group {
+	VIV2D_STATE_SRC = 1 << 0, // address, stride, rotation, config
+	VIV2D_STATE_SRC_ORIGIN = 1 << 1, // origin, size
+	VIV2D_STATE_DST = 1 << 2, // address, stride, rotation, config
+	VIV2D_STATE_ROP_CLIP = 1 << 3, // rop, clip top left, clip bottom right
+	VIV2D_STATE_ALPHA_CONTROL = 1 << 4,
+	VIV2D_STATE_ALPHA = 1 << 5, // modes, global colors, multiply modes
+	VIV2D_STATE_CLEAR_COLOR = 1 << 6,
+	VIV2D_STATE_PATTERN = 1 << 7,
+	VIV2D_STATE_STRETCH = 1 << 8,
+	VIV2D_STATE_MONO_COLOR = 1 << 9, // mono source bg, fg
+};
+
+typedef struct _Viv2DState {
+	uint32_t valid; // mask of viv2d_state_group holding known values
+
+	struct etna_bo *src_bo;
+	uint32_t src_offset;
+	uint32_t src_stride;
+	uint32_t src_config;
+	uint32_t src_origin;
+	uint32_t src_size;
+
+	struct etna_bo *dst_bo;
+	uint32_t dst_offset;
+	uint32_t dst_stride;
+	uint32_t dst_config;
+
+	uint32_t rop;
+	uint32_t clip_tl;
+	uint32_t clip_br;
+
+	uint32_t alpha_control;
+	uint32_t alpha_modes;
+	uint32_t global_src_color;
+	uint32_t global_dst_color;
+	uint32_t color_multiply;
+
+	uint32_t clear_color;
+	uint32_t pattern_color;
+	uint32_t stretch_low;
+	uint32_t stretch_high;
+	uint32_t mono_bg;
+	uint32_t mono_fg;
+
+	// pixmaps the src and dst states were last set from, their batch
+	// moves along when the states are replayed in a new stream
+	Viv2DPixmapPrivPtr src_pix;
+	Viv2DPixmapPrivPtr dst_pix;
+} Viv2DState;
+
 typedef struct _Viv2DRec {
 	int fd;
 	char *render_node;
 	struct etna_device *dev;
 	struct etna_gpu *gpu;
 	struct etna_pipe *pipe;
-	struct etna_cmd_stream *stream;
+	struct etna_cmd_stream *stream; // stream being built, one of streams[]
+
+	// ring of command streams, each slot tagged with its submit fence
+	struct etna_cmd_stream *streams[VIV2D_STREAM_COUNT];
+	uint32_t stream_fence[VIV2D_STREAM_COUNT];
+	uint32_t stream_serial[VIV2D_STREAM_COUNT]; // batch serial submitted in each slot
+	int cur_stream;
+	uint32_t last_fence; // fence of the last submitted stream
+	uint32_t batch_serial; // serial of the batch being built, used as EXA marker
+	uint32_t batch_start; // GetTimeInMillis() of the first command of the batch
+	struct _Viv2DSubmitQueue *submit; // submit worker, NULL to submit inline
+	Bool a8_target; // DE renders into A8
+#ifdef VIV2D_SUPPORT_MONO
+	CreateGCProcPtr CreateGC; // wrapped, see Viv2DCreateGC
+	// bitmaps are built in mono_buf, then packed one after the other into
+	// mono_bo until full, which is reused from its start once the gpu is done
+	uint8_t *mono_buf;
+	struct etna_bo *mono_bo;
+	uint32_t mono_used; // in bytes
+#endif
+#ifdef VIV2D_UPLOAD_TO_SCREEN
+	Viv2DStaging staging[VIV2D_UPLOAD_STAGING_COUNT];
+	int cur_staging;
+#endif
+#ifdef VIV2D_DOWNLOAD_FROM_SCREEN
+	struct etna_bo *readback; // cached, of the size class of the last readback
+	uint32_t readback_size;
+#endif
+#ifdef VIV2D_USERPTR
+	Viv2DUserptr userptr[VIV2D_USERPTR_CACHE_COUNT];
+	uint32_t userptr_stamp;
+#endif
+#ifdef VIV2D_PLACEMENT
+	int place_to_cpu; // MigrateToCPU, 0 leaves bo pixmaps in place
+	int place_to_gpu; // MigrateToGPU, 0 leaves malloc pixmaps in place
+	uint64_t migrated_to_cpu; // bytes moved each way, reported at close
+	uint64_t migrated_to_gpu;
+#endif
+#ifdef VIV2D_GRADIENT
+	CompositeProcPtr Composite; // wrapped, see Viv2DGradientComposite
+	Viv2DGradientStrip gradient_cache[VIV2D_GRADIENT_CACHE_COUNT];
+	uint32_t gradient_stamp;
+#endif
 
 	Viv2DOp op;
+	Viv2DState state;
+
+	Viv2DAtlas glyph_atlas[VIV2D_GLYPH_ATLAS_COUNT];
 
 	struct etna_bo *bo;
 	int width;
@@ -1,6 +1,36 @@
 // Global
 #define VIV2D_STREAM_SIZE 1024*32
-#define VIV2D_MAX_RECTS 256
+#define VIV2D_STREAM_MAX_SIZE 1024*64 // a stream grows up to this to keep an op in one submit
+#define VIV2D_STREAM_COUNT 4 // command streams in the submit ring
+#define VIV2D_FLUSH_QUEUED_WORDS 1024*8 // flush callback submits once this much is queued
+#define VIV2D_FLUSH_AGE_MS 8 // or once the batch is this old
+#define VIV2D_OP_RECTS 256 // initial rect batch of an op, grows on demand
+#define VIV2D_OP_MAX_RECTS 4096 // up to this, two passes of it and their states fit an empty stream
+#define VIV2D_MASK_TMP_SIZE 512 // masked composite scratch, rects are packed into it
+#define VIV2D_TILE_MIN_SIZE 64 // smaller repeating tiles are expanded to this first
+#define VIV2D_GLYPH_ATLAS_COUNT 8 // shared bos glyph pictures are carved from
+#define VIV2D_GLYPH_ATLAS_PITCH 2048 // bytes per atlas row
+#define VIV2D_GLYPH_ATLAS_HEIGHT 512 // atlas rows
+#define VIV2D_GLYPH_ATLAS_ALIGN 64 // glyph address alignment in bytes
+#define VIV2D_SCALE_MAX_SIZE 2048 // largest scaled copy of a transformed src
+#define VIV2D_MONO_MAX_SIZE 1024*256 // largest 1bpp bitmap expanded by the DE, in bytes
+#define VIV2D_MONO_ALIGN 64 // bitmap address alignment in the mono scratch bo
+#define VIV2D_GRADIENT_MAX_SIZE 2048 // longest gradient strip, in pixels
+#define VIV2D_GRADIENT_ROWS 64 // strips are stretched to this many rows, then repeated
+#define VIV2D_GRADIENT_CACHE_COUNT 16 // strips kept per screen, least recently used goes
+#define VIV2D_UPLOAD_STAGING_SIZE 1024*1024 // bytes of each upload staging bo
+#define VIV2D_UPLOAD_STAGING_COUNT 4 // staging bos, recycled once the gpu read them
+#define VIV2D_UPLOAD_STAGING_ALIGN 64 // upload address alignment in staging bos
+#define VIV2D_USERPTR_MIN_SIZE 1024*256 // uploads imported from client memory from this size
+#define VIV2D_READBACK_MIN_SIZE 1024*64 // smallest cached readback bo, sizes double from there
+#define VIV2D_READBACK_CLASSES 9 // readback bo sizes, up to VIV2D_MAX_SIZE
+#define VIV2D_USERPTR_CACHE_COUNT 4 // client memory imports reused until the next flush
+#define VIV2D_CACHED_WINDOW 64 // pixmap access counts are halved past this
+#define VIV2D_CACHED_MIN_READS 4 // cpu reads before a pixmap may go to a cached bo
+#define VIV2D_CACHED_GPU_RATIO 4 // to a cached bo when cpu reads * this >= gpu ops, back to wc when 4x below
+#define VIV2D_PLACE_TO_CPU 32 // MigrateToCPU default, recent cpu accesses before a pixmap the gpu hardly uses goes to malloc
+#define VIV2D_PLACE_TO_GPU 8 // MigrateToGPU default, recent gpu ops refused for lack of a bo before a malloc pixmap gets one
+#define VIV2D_PLACE_GPU_RATIO 8 // to malloc only while gpu ops * this < cpu accesses
 #define VIV2D_PITCH_ALIGN 32
 
 // EXA config
@@ -9,13 +39,21 @@
 
 #define VIV2D_SOLID 1
 #define VIV2D_COPY 1
+#define VIV2D_ROP 1 // GX raster ops and planemask for Solid and Copy
 #define VIV2D_COMPOSITE 1
 #define VIV2D_PUT_TEXTURE_IMAGE 1
+#define VIV2D_GLYPH_ATLAS 1 // glyph pictures share atlas bos
 
 #define VIV2D_MASK_SUPPORT 1 // support mask
 #define VIV2D_REPEAT 1 // support repeat
 #define VIV2D_REPEAT_WITH_MASK 1 // support repeat with mask
+#define VIV2D_REPEAT_TILE 1 // support RepeatNormal tiles larger than 1x1
+#define VIV2D_SCALE_TRANSFORM 1 // support scale only src transforms
 #define VIV2D_1X1_REPEAT_AS_SOLID 1 // use solid clear instead of stretch for 1x1 repeat
+#define VIV2D_ACCESS_REGION 1 // flush only the rows of dumb pixmaps damaged during a cpu access
+#define VIV2D_CACHED_PIXMAPS 1 // pixmaps the cpu reads often live in cached bos. needs VIV2D_ACCESS
+#define VIV2D_PLACEMENT 1 // move pixmaps between malloc and bos as they are used. needs VIV2D_CACHED_PIXMAPS
+#define VIV2D_SOLID_CACHE 1 // keep the color of 1x1 pixmaps, no readback once known. needs VIV2D_ACCESS
 #define VIV2D_SOLID_PICTURE_SRC 1 // support solid clear picture
 #define VIV2D_SUPPORT_A8_SRC 1
 #define VIV2D_SOLID_PICTURE_MSK 1 // support solid clear picture
@@ -24,12 +62,14 @@
 // EXPERIMENTAL
 #define VIV2D_PREPARE_SET_FORMAT 1
 //#define VIV2D_SOLID_FILL_BRUSH 1
-//#define VIV2D_SUPPORT_A8_DST 1
-//#define VIV2D_SUPPORT_MONO 1
-//#define VIV2D_UPLOAD_TO_SCREEN 1
-//#define VIV2D_DOWNLOAD_FROM_SCREEN 1
-//#define VIV2D_USERPTR 1
+#define VIV2D_SUPPORT_A8_DST 1 // where the DE has an A8 target, Solid emulated otherwise
+#define VIV2D_SUPPORT_MONO 1 // expand core text, stipples and XYBitmap images on the DE
+#define VIV2D_GRADIENT 1 // axis aligned linear gradients from cached strips. needs VIV2D_EXA_HACK
+#define VIV2D_UPLOAD_TO_SCREEN 1 // blit uploads from staging bos, never waits
+#define VIV2D_DOWNLOAD_FROM_SCREEN 1 // blit readbacks into cached bos
+#define VIV2D_USERPTR 1 // large uploads read in place from client memory, waits for the copy. needs VIV2D_UPLOAD_TO_SCREEN
 //#define VIV2D_COPY_BLEND 1
+//#define VIV2D_SUBMIT_THREAD 1 // submit command streams from a worker thread, needs the system libdrm_etnaviv (no ETNAVIV_CUSTOM)
 #define VIV2D_MASK_COMPONENT_SUPPORT 1
 #define VIV2D_FLUSH_CALLBACK 1
 #define VIV2D_CACHE_FLUSH_OPS 1
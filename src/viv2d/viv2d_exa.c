@@ -44,6 +44,7 @@
 #include "loongson_exa.h"
 #include "loongson_debug.h"
 #include "loongson_pixmap.h"
+#include "loongson_options.h"
 
 
 #include "etnaviv_drmif.h"
@@ -111,11 +112,7 @@ static Viv2DBlendOp viv2d_blend_op[] = {
 /**
  * Picture Formats and their counter parts
  */
-#ifdef VIV2D_SUPPORT_MONO
-#define VIV2D_PICT_FORMAT_COUNT 19
-#else
 #define VIV2D_PICT_FORMAT_COUNT 18
-#endif
 
 
 static const Viv2DFormat viv2d_pict_format[] =
@@ -138,9 +135,7 @@ static const Viv2DFormat viv2d_pict_format[] =
 	{PICT_x4b4g4r4, 16, 12, DE_FORMAT_X4R4G4B4, DE_SWIZZLE_ABGR, 0},
 	{PICT_a8, 8, 8, DE_FORMAT_A8, DE_SWIZZLE_ARGB, 8},
 //	{PICT_c8, 8, 8, DE_FORMAT_INDEX8, DE_SWIZZLE_ARGB, 8},
-#ifdef VIV2D_SUPPORT_MONO
-	{PICT_a1, 1, 1, DE_FORMAT_MONOCHROME, DE_SWIZZLE_ARGB, 1},
-#endif
+// no a1: DE mono sources expand to two colors, they carry no alpha
 	{NO_PICT_FORMAT, 0, 0, 0}
 	/*END*/
 };
@@ -152,10 +147,107 @@ static void Viv2DFlush(struct ARMSOCEXARec * pExa)
 	Viv2DRec *v2d = v2d_exa->v2d;
 
 //	VIV2D_INFO_MSG("Viv2DFlush");
-	_Viv2DStreamWait(v2d);
+	// the server is going to sleep, submit everything but never wait
 	_Viv2DStreamCommit(v2d, TRUE);
+	etna_bo_cache_clean(v2d->dev);
+}
+
+
+#ifdef VIV2D_GLYPH_ATLAS
+static Viv2DAtlas *Viv2DGlyphAtlasFromBo(Viv2DRec *v2d, struct etna_bo *bo)
+{
+	for (int i = 0; i < VIV2D_GLYPH_ATLAS_COUNT; i++) {
+		if (bo && v2d->glyph_atlas[i].bo == bo)
+			return &v2d->glyph_atlas[i];
+	}
+	return NULL;
+}
+
+// shelf pack bytes x height into atlas, FALSE once it is full
+static Bool Viv2DGlyphAtlasPack(Viv2DAtlas *atlas, int bytes, int height, int *x, int *y)
+{
+	int ax = atlas->x, ay = atlas->y, shelf = atlas->shelf;
+
+	if (ax + bytes > VIV2D_GLYPH_ATLAS_PITCH) {
+		ax = 0;
+		ay += shelf;
+		shelf = 0;
+	}
+
+	if (ay + height > VIV2D_GLYPH_ATLAS_HEIGHT)
+		return FALSE;
+
+	*x = ax;
+	*y = ay;
+	atlas->x = ax + bytes;
+	atlas->y = ay;
+	atlas->shelf = height > shelf ? height : shelf;
+	return TRUE;
 }
 
+/*
+ * Carve a glyph picture out of an atlas of the same bpp instead of giving
+ * it a bo of its own: glyphs are small and many, each bo costs at least a
+ * page, a gem handle and a reloc entry per use. The glyph is a sub-rect of
+ * the atlas, its pitch being the atlas one.
+ */
+static Bool Viv2DGlyphAtlasAlloc(Viv2DRec *v2d, int width, int height, int bpp,
+        struct ARMSOCEXABuf *buf)
+{
+	int bytes = ALIGN(width * bpp / 8, VIV2D_GLYPH_ATLAS_ALIGN);
+	Viv2DAtlas *atlas = NULL;
+	int x, y, i;
+
+	if ((bpp != 8 && bpp != 32) || bytes > VIV2D_GLYPH_ATLAS_PITCH / 4 ||
+	        height > VIV2D_GLYPH_ATLAS_HEIGHT / 4)
+		return FALSE;
+
+	for (i = 0; i < VIV2D_GLYPH_ATLAS_COUNT; i++) {
+		Viv2DAtlas *a = &v2d->glyph_atlas[i];
+		if (a->bo && a->bpp == bpp && Viv2DGlyphAtlasPack(a, bytes, height, &x, &y)) {
+			atlas = a;
+			break;
+		}
+	}
+
+	// start a new atlas, or recycle one whose glyphs are all gone. new
+	// glyphs are written by the cpu, blits still reading the old ones,
+	// queued or in flight, must be done first
+	for (i = 0; !atlas && i < VIV2D_GLYPH_ATLAS_COUNT; i++) {
+		Viv2DAtlas *a = &v2d->glyph_atlas[i];
+
+		if (a->bo && (a->used > 0 || !etna_bo_idle(a->bo, ETNA_PREP_WRITE)))
+			continue;
+
+		if (!a->bo) {
+			a->bo = etna_bo_new(v2d->dev, VIV2D_GLYPH_ATLAS_PITCH * VIV2D_GLYPH_ATLAS_HEIGHT, ETNA_BO_WC);
+			if (!a->bo)
+				return FALSE;
+			a->map = etna_bo_map(a->bo);
+		}
+
+		a->bpp = bpp;
+		a->x = a->y = a->shelf = a->used = 0;
+		Viv2DGlyphAtlasPack(a, bytes, height, &x, &y);
+		atlas = a;
+	}
+
+	if (!atlas)
+		return FALSE;
+
+	atlas->used++;
+
+	buf->priv = (void *)atlas->bo;
+	buf->flags = 0; // shared, not a bo of its own
+	buf->buf = atlas->map + y * VIV2D_GLYPH_ATLAS_PITCH + x;
+	buf->pitch = VIV2D_GLYPH_ATLAS_PITCH;
+	buf->size = VIV2D_GLYPH_ATLAS_PITCH * height;
+
+	VIV2D_DBG_MSG("Viv2DGlyphAtlasAlloc: buf:%p atlas:%d %dx%d at %d,%d", buf,
+	              (int)(atlas - v2d->glyph_atlas), width, height, x, y);
+	return TRUE;
+}
+#endif
 
 static void Viv2DAllocBuf(struct ARMSOCEXARec *exa, int width, int height,
         int depth, int bpp, int usage_hint, struct ARMSOCEXABuf *buf)
@@ -169,6 +261,12 @@ static void Viv2DAllocBuf(struct ARMSOCEXARec *exa, int width, int height,
     VIV2D_DBG_MSG("Viv2DAllocBuf: buf:%p size:%d", buf, ALIGN(size, 4096));
     Viv2DFormat fmt;
 
+#ifdef VIV2D_GLYPH_ATLAS
+    if (usage_hint == CREATE_PIXMAP_USAGE_GLYPH_PICTURE &&
+            Viv2DGlyphAtlasAlloc(v2d, width, height, bpp, buf))
+        return;
+#endif
+
     // do not create etna bo if too small or unsupported format
     if (size > VIV2D_MIN_SIZE && size < VIV2D_MAX_SIZE)
     { // && _Viv2DSetFormat(depth, bpp, &fmt)) {
@@ -176,11 +274,13 @@ static void Viv2DAllocBuf(struct ARMSOCEXARec *exa, int width, int height,
         //	VIV2D_INFO_MSG("Viv2DAllocBuf size:%d pitch:%d", pitch * height, pitch);
         bo = etna_bo_cache_new(v2d->dev, size, ETNA_BO_WC);
         buf->priv = (void *)bo;
+        buf->flags = ETNA_BO_WC;
         buf->buf = etna_bo_map(bo);
     }
     else
     {
         VIV2D_DBG_MSG("Viv2DAllocBuf: use CPU only memory buf:%p size:%d", buf, size);
+        buf->flags = 0;
         if (size > 0)
         {
             buf->priv = NULL;
@@ -206,6 +306,13 @@ static void Viv2DFreeBuf(struct ARMSOCEXARec *exa, struct ARMSOCEXABuf *buf)
         Viv2DEXAPtr v2d_exa = (Viv2DEXAPtr)(exa);
         Viv2DRec *v2d = v2d_exa->v2d;
         struct etna_bo *bo = (struct etna_bo *)buf->priv;
+#ifdef VIV2D_GLYPH_ATLAS
+        Viv2DAtlas *atlas = Viv2DGlyphAtlasFromBo(v2d, bo);
+
+        if (atlas)
+            atlas->used--;
+        else
+#endif
         etna_bo_cache_del(v2d->dev, bo);
     }
     else
@@ -215,6 +322,7 @@ static void Viv2DFreeBuf(struct ARMSOCEXARec *exa, struct ARMSOCEXABuf *buf)
             free(buf->buf);
     }
     buf->priv = NULL;
+    buf->flags = 0;
     buf->buf = NULL;
     buf->pitch = 0;
     buf->size = 0;
@@ -236,6 +344,7 @@ static Bool Viv2DMapUsermemBuf(struct ARMSOCEXARec *exa,
         VIV2D_INFO_MSG("Viv2DMapUsermemBuf bo:%p buf:%p", aligned_bo, data);
 
         buf->priv = aligned_bo;
+        buf->flags = 0;
         buf->buf = data;
         buf->size = size;
         buf->pitch = pitch;
@@ -264,6 +373,7 @@ static void Viv2DUnmapUsermemBuf(struct ARMSOCEXARec *exa, struct ARMSOCEXABuf *
         etna_bo_cache_usermem_del(v2d->dev, bo);
 
         buf->priv = NULL;
+        buf->flags = 0;
         buf->buf = NULL;
         buf->size = 0;
         buf->pitch = 0;
@@ -288,14 +398,15 @@ static inline void Viv2DDetachBo(struct ARMSOCRec *pARMSOC, struct ARMSOCPixmapP
             {
                 VIV2D_DBG_MSG("Viv2DDetachBo detach pix:%p bo:%p dumbBo:%p refcnt:%d",
                     pix, pix->bo, armsocPix->bo, pix->refcnt);
-                if (!etna_bo_ready(pix->bo))
-                {
+                // the kernel keeps the bo alive until submitted work is done,
+                // only the relocs of the streams not submitted yet need it
+                if (pix->batch == v2d->batch_serial)
                     _Viv2DStreamCommit(v2d, TRUE);
-                    _Viv2DStreamWait(v2d);
-                }
+                _Viv2DStreamSync(v2d);
                 etna_bo_del(pix->bo);
             }
             pix->bo = NULL;
+            pix->offset = 0;
         }
     }
 }
@@ -336,6 +447,11 @@ static inline Bool Viv2DAttachBo(struct ARMSOCRec *pARMSOC,
             if (armsocPix->buf.priv)
             {
                 pix->bo = (struct etna_bo *)armsocPix->buf.priv;
+#ifdef VIV2D_GLYPH_ATLAS
+                Viv2DAtlas *atlas = Viv2DGlyphAtlasFromBo(v2d, pix->bo);
+                if (atlas)
+                    pix->offset = (uint8_t *)armsocPix->buf.buf - atlas->map;
+#endif
                 VIV2D_DBG_MSG("Viv2DAttachBo attach from armsoc buf pix:%p bo:%p buf:%p size:%d",
                     pix, pix->bo, armsocPix->buf.buf, armsocPix->buf.size);
             }
@@ -346,6 +462,10 @@ static inline Bool Viv2DAttachBo(struct ARMSOCRec *pARMSOC,
                 pix->bo = NULL;
             }
         }
+#ifdef VIV2D_CACHED_PIXMAPS
+        pix->cached = pix->bo && pix->bo == armsocPix->buf.priv &&
+                (armsocPix->buf.flags & ETNA_BO_CACHED);
+#endif
         return TRUE;
     }
     else
@@ -372,6 +492,10 @@ static void Viv2DReattach(PixmapPtr pPixmap, int width, int height, int pitch)
     Viv2DPixmapPrivPtr pix = armsocPix->priv;
     VIV2D_DBG_MSG("Viv2DReattach pix %p", pix);
 
+#ifdef VIV2D_SOLID_CACHE
+    pix->solid_known = FALSE;
+#endif
+
     pix->width = width;
     pix->height = height;
     pix->pitch = pitch;
@@ -420,32 +544,64 @@ static inline uint32_t Viv2DColour(Pixel pixel, int depth)
     return colour;
 }
 
+// colour of a pixel value of a drawable, A8 pixels go to the alpha channel
+static inline uint32_t Viv2DPixelColour(Pixel pixel, int depth)
+{
+    if (depth == 8)
+        return (uint32_t)(pixel & 0xff) << 24;
+    return Viv2DColour(pixel, depth);
+}
+
 
 #ifdef VIV2D_1X1_REPEAT_AS_SOLID
-static CARD32 Viv2DGetFirstPixel(DrawablePtr pDraw)
+static CARD32 Viv2DGetFirstPixel(PixmapPtr pPixmap)
 {
+    DrawablePtr pDraw = &pPixmap->drawable;
+    CARD32 value;
     union {
         CARD32 c32;
         CARD16 c16;
         CARD8 c8;
         char c;
     } pixel;
+#ifdef VIV2D_SOLID_CACHE
+    struct ARMSOCPixmapPrivRec *armsocPix = exaGetPixmapDriverPrivate(pPixmap);
+    Viv2DPixmapPrivPtr pix = armsocPix ? armsocPix->priv : NULL;
+
+    // nothing wrote to it since the last readback or solid fill: the
+    // readback would map the bo and wait for the gpu
+    if (pix && pix->solid_known)
+        return pix->solid;
+#endif
 
     pDraw->pScreen->GetImage(pDraw, 0, 0, 1, 1, ZPixmap, ~0, &pixel.c);
 
     switch (pDraw->bitsPerPixel)
     {
         case 32:
-            return pixel.c32;
+            value = pixel.c32;
+            break;
         case 16:
-            return pixel.c16;
+            value = pixel.c16;
+            break;
         case 8:
         case 4:
         case 1:
-            return pixel.c8;
+            value = pixel.c8;
+            break;
         default:
             assert(0);
+            value = 0;
+    }
+
+#ifdef VIV2D_SOLID_CACHE
+    if (pix)
+    {
+        pix->solid_known = TRUE;
+        pix->solid = value;
     }
+#endif
+    return value;
 }
 #endif
 
@@ -503,6 +659,10 @@ static PixmapPtr GetDrawablePixmap(DrawablePtr pDrawable)
 
 
 #ifdef VIV2D_FLUSH_CALLBACK
+#ifdef VIV2D_USERPTR
+static void Viv2DUserptrDrop(Viv2DRec *v2d);
+#endif
+
 static void Viv2DFlushCallback(CallbackListPtr *list, pointer user_data,
         pointer call_data)
 {
@@ -511,19 +671,51 @@ static void Viv2DFlushCallback(CallbackListPtr *list, pointer user_data,
     Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 
     //	VIV2D_INFO_MSG("Viv2DFlushCallback");
-    _Viv2DStreamWait(v2d);
-    _Viv2DStreamCommit(v2d, TRUE);
-
+    // runs on every reply sent to clients, keep it from touching the gpu
+    // unless the batch is big or old enough, and never wait
+    _Viv2DStreamFlushPending(v2d);
+#ifdef VIV2D_USERPTR
+    Viv2DUserptrDrop(v2d);
+#endif
 }
 #endif
 
+/**
+ * MarkSync() returns the serial of the batch being built, the accelerated
+ * ops queued so far are all part of it or of an earlier batch.
+ */
 static int Viv2DMarkSync(ScreenPtr pScreen)
 {
-    return 0;
+    Viv2DRec *v2d = Viv2DPrivFromScreen(pScreen);
+
+    return (int)v2d->batch_serial;
 }
 
+/**
+ * WaitMarker() waits for the fence of the batch a marker was taken in,
+ * submitting that batch first if it is still being built.
+ */
 static void Viv2DWaitMarker(ScreenPtr pScreen, int marker)
 {
+    Viv2DRec *v2d = Viv2DPrivFromScreen(pScreen);
+    uint32_t fence;
+
+    if ((uint32_t)marker == v2d->batch_serial)
+    {
+        // nothing to submit if the batch is empty, then the last
+        // submitted fence covers everything before the marker
+        _Viv2DStreamCommit(v2d, TRUE);
+        _Viv2DStreamSync(v2d);
+        fence = v2d->last_fence;
+    }
+    else
+    {
+        _Viv2DStreamSync(v2d);
+        fence = _Viv2DStreamSerialFence(v2d, marker);
+    }
+
+    if (fence && etna_pipe_wait(v2d->pipe, fence, ETNAVIV_WAIT_PIPE_MS))
+        VIV2D_INFO_MSG("Viv2DWaitMarker wait marker:%d fence:%d failed", marker, fence);
 }
 
 
@@ -574,6 +766,49 @@ static Bool LS_IsDumbPixmap(struct ARMSOCPixmapPrivRec *priv)
 
 
 
+#ifdef VIV2D_ACCESS_REGION
+// damage is reported before the drawing it covers runs, so once an fb
+// fallback finishes its access the rows it wrote are known
+static void Viv2DAccessDamageReport(DamagePtr pDamage, RegionPtr pRegion, void *closure)
+{
+    Viv2DPixmapPrivPtr pix = closure;
+    BoxPtr ext = RegionExtents(pRegion);
+
+    if (pix->damage_box.x1 >= pix->damage_box.x2)
+    {
+        pix->damage_box = *ext;
+        return;
+    }
+
+    pix->damage_box.x1 = min(pix->damage_box.x1, ext->x1);
+    pix->damage_box.y1 = min(pix->damage_box.y1, ext->y1);
+    pix->damage_box.x2 = max(pix->damage_box.x2, ext->x2);
+    pix->damage_box.y2 = max(pix->damage_box.y2, ext->y2);
+}
+
+static void Viv2DAccessDamageDestroy(DamagePtr pDamage, void *closure)
+{
+    Viv2DPixmapPrivPtr pix = closure;
+
+    pix->damage = NULL;
+}
+
+// follow what is drawn to a dumb pixmap from its first cpu access on.
+// an op reports its damage before it prepares access, so the box is
+// only emptied once flushed, in FinishAccess. the drawing of the first
+// access was reported before the damage existed and is not in the box
+static void Viv2DAccessDamageTrack(PixmapPtr pPixmap, Viv2DPixmapPrivPtr pix)
+{
+    if (!pix || pix->damage)
+        return;
+
+    pix->damage = DamageCreate(Viv2DAccessDamageReport, Viv2DAccessDamageDestroy,
+            DamageReportRawRegion, TRUE, pPixmap->drawable.pScreen, pix);
+    if (pix->damage)
+        DamageRegister(&pPixmap->drawable, pix->damage);
+}
+#endif
+
 _X_EXPORT Bool ARMSOCPrepareAccess(PixmapPtr pPixmap, int index)
 {
     struct ARMSOCPixmapPrivRec *priv = exaGetPixmapDriverPrivate(pPixmap);
@@ -618,6 +853,10 @@ _X_EXPORT Bool ARMSOCPrepareAccess(PixmapPtr pPixmap, int index)
         return FALSE;
     }
 
+#ifdef VIV2D_ACCESS_REGION
+    Viv2DAccessDamageTrack(pPixmap, priv->priv);
+#endif
+
     /*
     * Attach dmabuf fd to bo to synchronise access if pixmap wrapped by DRI2
     */
@@ -652,6 +891,217 @@ _X_EXPORT Bool ARMSOCPrepareAccess(PixmapPtr pPixmap, int index)
     return TRUE;
 }
 
+#ifdef VIV2D_CACHED_PIXMAPS
+/*
+ * Move the content of a pixmap to a bo of the other caching mode, the gpu
+ * copies it as raw 32bpp rows. The old bo goes once the gpu is done.
+ */
+static void Viv2DPixmapSetCached(Viv2DRec *v2d, struct ARMSOCPixmapPrivRec *armsocPix, Bool cached)
+{
+    Viv2DPixmapPrivPtr pix = armsocPix->priv;
+    Viv2DPixmapPrivRec from = *pix;
+    Viv2DPixmapPrivRec to;
+    struct etna_bo *bo;
+    Viv2DRect rect;
+
+    if (cached)
+        bo = etna_bo_new(v2d->dev, armsocPix->buf.size, ETNA_BO_CACHED);
+    else
+        bo = etna_bo_cache_new(v2d->dev, armsocPix->buf.size, ETNA_BO_WC);
+    if (!bo)
+        return;
+
+    _Viv2DSetFormat(32, 32, &from.format);
+    from.width = from.pitch / 4;
+    from.height = armsocPix->buf.size / from.pitch;
+    to = from;
+    to.bo = bo;
+
+    rect.x1 = 0;
+    rect.y1 = 0;
+    rect.x2 = from.width;
+    rect.y2 = from.height;
+
+    _Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
+    _Viv2DStreamSrc(v2d, &from);
+    _Viv2DStreamSrcOrigin(v2d, 0, 0, from.width, from.height);
+    _Viv2DStreamDst(v2d, &to, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+    _Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0);
+    _Viv2DStreamRects(v2d, &rect, 1);
+    _Viv2DStreamCacheFlush(v2d);
+
+    VIV2D_DBG_MSG("Viv2DPixmapSetCached pix:%p bo:%p -> %p cached:%d gpu:%d read:%d write:%d",
+            pix, pix->bo, bo, cached, pix->gpu_ops, pix->cpu_reads, pix->cpu_writes);
+
+    etna_bo_cache_del(v2d->dev, pix->bo);
+
+    armsocPix->buf.priv = (void *)bo;
+    armsocPix->buf.flags = cached ? ETNA_BO_CACHED : ETNA_BO_WC;
+    armsocPix->buf.buf = etna_bo_map(bo);
+    pix->bo = bo;
+    pix->cached = cached;
+    pix->batch = v2d->batch_serial;
+    pix->refcnt++;
+}
+
+// the pixmap is backed by a whole bo of Viv2DAllocBuf, not a dumb or
+// imported buffer, client memory or a glyph atlas slot
+static Bool Viv2DPixmapOwnsBo(Viv2DRec *v2d, struct ARMSOCPixmapPrivRec *armsocPix)
+{
+    Viv2DPixmapPrivPtr pix = armsocPix->priv;
+
+    if (!pix->bo || armsocPix->bo || armsocPix->buf.priv != pix->bo)
+        return FALSE;
+    if (!(armsocPix->buf.flags & (ETNA_BO_WC | ETNA_BO_CACHED)))
+        return FALSE;
+#ifdef VIV2D_GLYPH_ATLAS
+    if (Viv2DGlyphAtlasFromBo(v2d, pix->bo))
+        return FALSE;
+#endif
+    return TRUE;
+}
+
+#ifdef VIV2D_PLACEMENT
+static void Viv2DPixmapPlaceReset(Viv2DPixmapPrivPtr pix)
+{
+    pix->gpu_ops = 0;
+    pix->gpu_misses = 0;
+    pix->cpu_reads = 0;
+    pix->cpu_writes = 0;
+}
+
+/*
+ * Move a bo pixmap the gpu hardly uses to malloc memory, its cpu accesses
+ * no longer wait on the gpu nor go through uncached or flushed mappings.
+ * The counts start over, it takes place_to_gpu refused ops to come back.
+ */
+static Bool Viv2DPixmapToCpu(Viv2DRec *v2d, struct ARMSOCPixmapPrivRec *armsocPix)
+{
+    Viv2DPixmapPrivPtr pix = armsocPix->priv;
+    int cpu = pix->cpu_reads + pix->cpu_writes;
+    Bool prep = pix->refcnt > 0 || pix->cached;
+    void *buf;
+
+    if (!v2d->place_to_cpu || cpu < v2d->place_to_cpu ||
+            pix->gpu_ops * VIV2D_PLACE_GPU_RATIO >= cpu)
+        return FALSE;
+
+    buf = malloc(armsocPix->buf.size);
+    if (!buf)
+        return FALSE;
+
+    if (prep)
+    {
+        if (pix->batch == v2d->batch_serial)
+            _Viv2DStreamCommit(v2d, TRUE);
+        _Viv2DStreamSync(v2d);
+        etna_bo_cpu_prep(pix->bo, DRM_ETNA_PREP_READ);
+    }
+    memcpy(buf, armsocPix->buf.buf, armsocPix->buf.size);
+    if (prep)
+        etna_bo_cpu_fini(pix->bo);
+
+    VIV2D_DBG_MSG("Viv2DPixmapToCpu pix:%p bo:%p size:%d gpu:%d read:%d write:%d",
+            pix, pix->bo, armsocPix->buf.size, pix->gpu_ops, pix->cpu_reads, pix->cpu_writes);
+
+    etna_bo_cache_del(v2d->dev, pix->bo);
+
+    armsocPix->buf.priv = NULL;
+    armsocPix->buf.flags = 0;
+    armsocPix->buf.buf = buf;
+    pix->bo = NULL;
+    pix->cached = FALSE;
+    pix->refcnt = 0;
+    pix->batch = 0;
+    Viv2DPixmapPlaceReset(pix);
+    v2d->migrated_to_cpu += armsocPix->buf.size;
+    return TRUE;
+}
+
+/*
+ * Count a gpu op refused because pPixmap lives in malloc memory, and give
+ * it a bo once that happens often. Only buffers of Viv2DAllocBuf move,
+ * with the same pitch and size so the pixmap header stays valid.
+ */
+static void Viv2DPixmapToGpu(Viv2DRec *v2d, PixmapPtr pPixmap)
+{
+    struct ARMSOCPixmapPrivRec *armsocPix = exaGetPixmapDriverPrivate(pPixmap);
+    Viv2DPixmapPrivPtr pix = armsocPix ? armsocPix->priv : NULL;
+    struct etna_bo *bo;
+    void *map;
+
+    if (!pix || pix->bo || pix->refcnt < 0 || armsocPix->bo ||
+            armsocPix->buf.priv || !armsocPix->buf.buf)
+        return;
+
+    pix->gpu_misses++;
+    _Viv2DPixAge(pix);
+
+    if (!v2d->place_to_gpu || pix->gpu_misses < v2d->place_to_gpu ||
+            armsocPix->buf.size >= VIV2D_MAX_SIZE)
+        return;
+
+    bo = etna_bo_cache_new(v2d->dev, armsocPix->buf.size, ETNA_BO_WC);
+    if (!bo)
+        return;
+    map = etna_bo_map(bo);
+    if (!map)
+    {
+        etna_bo_cache_del(v2d->dev, bo);
+        return;
+    }
+    memcpy(map, armsocPix->buf.buf, armsocPix->buf.size);
+
+    VIV2D_DBG_MSG("Viv2DPixmapToGpu pix:%p bo:%p size:%d misses:%d read:%d write:%d",
+            pix, bo, armsocPix->buf.size, pix->gpu_misses, pix->cpu_reads, pix->cpu_writes);
+
+    free(armsocPix->buf.buf);
+    armsocPix->buf.priv = (void *)bo;
+    armsocPix->buf.flags = ETNA_BO_WC;
+    armsocPix->buf.buf = map;
+    pix->bo = bo;
+    pix->cached = FALSE;
+    pix->refcnt = 0;
+    pix->batch = 0;
+    Viv2DPixmapPlaceReset(pix);
+    v2d->migrated_to_gpu += armsocPix->buf.size;
+}
+#endif
+
+// count a cpu access and pick where the pixmap lives from the recent
+// accesses: malloc once the gpu hardly touches it, else a cached or wc bo.
+// wc reads are uncached, cached bos cost a cache flush or invalidate on
+// every access. only our own bos move
+static void Viv2DPixmapPlace(Viv2DRec *v2d, struct ARMSOCPixmapPrivRec *armsocPix, int index)
+{
+    Viv2DPixmapPrivPtr pix = armsocPix->priv;
+
+    if (idx2op(index) == DRM_ETNA_PREP_WRITE)
+        pix->cpu_writes++;
+    else
+        pix->cpu_reads++;
+    _Viv2DPixAge(pix);
+
+    if (pix->refcnt < 0 || !Viv2DPixmapOwnsBo(v2d, armsocPix))
+        return;
+#ifdef VIV2D_PLACEMENT
+    if (Viv2DPixmapToCpu(v2d, armsocPix))
+        return;
+#endif
+
+    if (!pix->cached)
+    {
+        if (pix->cpu_reads >= VIV2D_CACHED_MIN_READS &&
+                pix->cpu_reads * VIV2D_CACHED_GPU_RATIO >= pix->gpu_ops)
+            Viv2DPixmapSetCached(v2d, armsocPix, TRUE);
+    }
+    else if (pix->cpu_reads * VIV2D_CACHED_GPU_RATIO * 4 < pix->gpu_ops)
+    {
+        Viv2DPixmapSetCached(v2d, armsocPix, FALSE);
+    }
+}
+#endif
+
 /**
  * PrepareAccess() is called before CPU access to an offscreen pixmap.
  *
@@ -694,8 +1144,21 @@ static Bool Viv2DPrepareAccess(PixmapPtr pPixmap, int index)
     // VIV2D_DBG_MSG("Viv2DPrepareAccess %p (%dx%d) %d (%d)",
     //   pPixmap, pix->width, pix->height, index, pix->refcnt);
 
+#ifdef VIV2D_SOLID_CACHE
+    // the cpu may write anything
+    if (idx2op(index) == DRM_ETNA_PREP_WRITE)
+        pix->solid_known = FALSE;
+#endif
+
+#ifdef VIV2D_CACHED_PIXMAPS
+    Viv2DPixmapPlace(v2d, armsocPix, index);
+
+    // cached bos are invalidated for every cpu access, not only after gpu use
+    if (pix->refcnt > 0 || (pix->cached && pix->refcnt == 0 && pix->bo))
+#else
     // only if pixmap has been used
     if (pix->refcnt > 0)
+#endif
     {
         // flush if remaining state
         if (pix->bo)
@@ -703,11 +1166,12 @@ static Bool Viv2DPrepareAccess(PixmapPtr pPixmap, int index)
             VIV2D_DBG_MSG("Viv2DPrepareAccess pix:%p/%p(%dx%d) bo:%p index:%d refcnt:(%d)",
                     pPixmap, pix, pix->width, pix->height, pix->bo, index, pix->refcnt);
 
-            if (!etna_bo_ready(pix->bo))
-            {
+            // submit only if the stream being built references the bo,
+            // then let cpu_prep wait on this bo fences alone: reads wait
+            // for the last gpu write, writes for the last gpu access
+            if (pix->batch == v2d->batch_serial)
                 _Viv2DStreamCommit(v2d, TRUE);
-                _Viv2DStreamWait(v2d);
-            }
+            _Viv2DStreamSync(v2d);
 
             etna_bo_cpu_prep(pix->bo, idx2op(index));
 
@@ -738,12 +1202,32 @@ _X_EXPORT void ARMSOCFinishAccess(PixmapPtr pPixmap, int index)
 
     pPixmap->devPrivate.ptr = NULL;
 
-    /* NOTE: can we use EXA migration module to track which parts of the
-     * buffer was accessed by sw, and pass that info down to kernel to
-     * do a more precise cache flush..
+    /* EXA does not pass the accessed region down, the damage drawn
+     * since the last flush narrows it to the rows drawn to. flushes
+     * are whole rows, the x extent of the box is not used. a read
+     * access nothing was drawn to skips the flush, a write access
+     * with an empty box may be the first one, which the damage does
+     * not cover, and flushes the whole buffer
      */
     if( LS_IsDumbPixmap(priv) )
     {
+#ifdef VIV2D_ACCESS_REGION
+        Viv2DPixmapPrivPtr pix = priv->priv;
+
+        if (pix && pix->damage)
+        {
+            BoxRec box = pix->damage_box;
+
+            pix->damage_box.x1 = pix->damage_box.x2 = 0;
+            if (box.x1 < box.x2 && box.y1 < box.y2)
+            {
+                armsoc_bo_cpu_fini_region(priv->bo, box.y1, box.y2);
+                return;
+            }
+            if (idx2op(index) == DRM_ETNA_PREP_READ)
+                return;
+        }
+#endif
         armsoc_bo_cpu_fini(priv->bo);
     }
 }
@@ -783,8 +1267,114 @@ static void Viv2DFinishAccess(PixmapPtr pPixmap, int index)
 #include "fb.h"
 #include "fbpict.h"
 
-// Trapezoids hack
-void Viv2DTrapezoids(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
+// upload an a8 coverage rasterized in cached memory into a gpu scratch and
+// wrap it in a picture, NULL when the scratch is not gpu backed
+static PicturePtr Viv2DCoveragePicture(ScreenPtr pScreen, pixman_image_t *image,
+        int width, int height)
+{
+    PictFormatPtr format = PictureMatchFormat(pScreen, 8, PICT_a8);
+    struct ARMSOCPixmapPrivRec *armsocPix;
+    Viv2DPixmapPrivPtr pix;
+    PixmapPtr pPixmap;
+    PicturePtr pPicture;
+    uint8_t *src, *buf;
+    int src_pitch, error;
+
+    if (!format)
+        return NULL;
+
+    pPixmap = pScreen->CreatePixmap(pScreen, width, height, 8, CREATE_PIXMAP_USAGE_SCRATCH);
+    if (!pPixmap)
+        return NULL;
+
+    armsocPix = exaGetPixmapDriverPrivate(pPixmap);
+    pix = armsocPix ? armsocPix->priv : NULL;
+    if (!pix || !pix->bo)
+    {
+        pScreen->DestroyPixmap(pPixmap);
+        return NULL;
+    }
+
+    // one sequential write into the write-combined scratch
+    src = (uint8_t *) pixman_image_get_data(image);
+    src_pitch = pixman_image_get_stride(image);
+    buf = (uint8_t *) etna_bo_map(pix->bo) + pix->offset;
+
+    etna_bo_cpu_prep(pix->bo, DRM_ETNA_PREP_WRITE);
+    for (int y = 0; y < height; y++)
+    {
+        memcpy(buf, src, width);
+        src += src_pitch;
+        buf += pix->pitch;
+    }
+    etna_bo_cpu_fini(pix->bo);
+
+    pPicture = CreatePicture(0, &pPixmap->drawable, format, 0, 0, serverClient, &error);
+
+    // the picture keeps its own reference
+    pScreen->DestroyPixmap(pPixmap);
+
+    return pPicture;
+}
+
+// coverage mask of bounds, clipped to the destination, in cached memory
+static pixman_image_t *Viv2DCoverageImage(PicturePtr pDstPicture, BoxPtr bounds)
+{
+    DrawablePtr pDrawable = pDstPicture->pDrawable;
+
+    bounds->x1 = max(bounds->x1, 0);
+    bounds->y1 = max(bounds->y1, 0);
+    bounds->x2 = min(bounds->x2, pDrawable->width);
+    bounds->y2 = min(bounds->y2, pDrawable->height);
+
+    if (bounds->x1 >= bounds->x2 || bounds->y1 >= bounds->y2)
+        return NULL;
+
+    return pixman_image_create_bits(PIXMAN_a8, bounds->x2 - bounds->x1,
+            bounds->y2 - bounds->y1, NULL, 0);
+}
+
+// shapes go through the gpu when the destination lives there and they
+// are antialiased into an a8 mask
+static Bool Viv2DCoverageSupported(PicturePtr pDstPicture, PictFormatPtr maskFormat)
+{
+    PixmapPtr pDst = GetDrawablePixmap(pDstPicture->pDrawable);
+    struct ARMSOCPixmapPrivRec *armsocPix;
+    Viv2DPixmapPrivPtr pix;
+
+    if (!pDst)
+        return FALSE;
+
+    if (maskFormat ? maskFormat->depth != 8 : pDstPicture->polyEdge == PolyEdgeSharp)
+        return FALSE;
+
+    armsocPix = exaGetPixmapDriverPrivate(pDst);
+    pix = armsocPix ? armsocPix->priv : NULL;
+    return pix && pix->bo;
+}
+
+// composite the coverage of bounds, src is read at dst + (src_dx, src_dy)
+static Bool Viv2DCompositeCoverage(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
+        pixman_image_t *image, BoxPtr bounds, int src_dx, int src_dy)
+{
+    ScreenPtr pScreen = pDstPicture->pDrawable->pScreen;
+    int width = bounds->x2 - bounds->x1;
+    int height = bounds->y2 - bounds->y1;
+    PicturePtr pMask;
+
+    pMask = Viv2DCoveragePicture(pScreen, image, width, height);
+    if (!pMask)
+        return FALSE;
+
+    CompositePicture(op, pSrcPicture, pMask, pDstPicture,
+            bounds->x1 + src_dx, bounds->y1 + src_dy, 0, 0,
+            bounds->x1, bounds->y1, width, height);
+
+    FreePicture(pMask, 0);
+    return TRUE;
+}
+
+static void Viv2DFbTrapezoids(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
         PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntrap,
         xTrapezoid * traps)
 {
@@ -796,8 +1386,6 @@ void Viv2DTrapezoids(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
     if (pDst)
         Viv2DPrepareAccess(pDst, EXA_PREPARE_DEST);
 
-    VIV2D_DBG_MSG("Viv2DTrapezoids");
-
     fbTrapezoids(op, pSrcPicture, pDstPicture, maskFormat, xSrc, ySrc, ntrap, traps);
     if (pDst)
         Viv2DFinishAccess(pDst, EXA_PREPARE_DEST);
@@ -805,6 +1393,50 @@ void Viv2DTrapezoids(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
         Viv2DFinishAccess(pSrc, EXA_PREPARE_SRC);
 }
 
+// Trapezoids: rasterize the coverage on the cpu in cached memory, then
+// composite it with the gpu, src and dst stay gpu side
+void Viv2DTrapezoids(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
+        PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntrap,
+        xTrapezoid * traps)
+{
+    int src_dx, src_dy;
+
+    VIV2D_DBG_MSG("Viv2DTrapezoids");
+
+    if (ntrap <= 0)
+        return;
+
+    if (!Viv2DCoverageSupported(pDstPicture, maskFormat))
+    {
+        Viv2DFbTrapezoids(op, pSrcPicture, pDstPicture, maskFormat, xSrc, ySrc, ntrap, traps);
+        return;
+    }
+
+    src_dx = xSrc - (traps[0].left.p1.x >> 16);
+    src_dy = ySrc - (traps[0].left.p1.y >> 16);
+
+    // without a mask format every trapezoid is composited on its own
+    for (int i = 0; i < ntrap; i += maskFormat ? ntrap : 1)
+    {
+        int n = maskFormat ? ntrap : 1;
+        pixman_image_t *image;
+        BoxRec bounds;
+
+        miTrapezoidBounds(n, &traps[i], &bounds);
+        image = Viv2DCoverageImage(pDstPicture, &bounds);
+        if (!image)
+            continue;
+
+        pixman_add_trapezoids(image, -bounds.x1, -bounds.y1, n, (pixman_trapezoid_t *) &traps[i]);
+
+        if (!Viv2DCompositeCoverage(op, pSrcPicture, pDstPicture, image, &bounds, src_dx, src_dy))
+            Viv2DFbTrapezoids(op, pSrcPicture, pDstPicture, maskFormat,
+                    (traps[i].left.p1.x >> 16) + src_dx, (traps[i].left.p1.y >> 16) + src_dy, n, &traps[i]);
+
+        pixman_image_unref(image);
+    }
+}
+
 
 void Viv2DAddTraps(PicturePtr pPicture, INT16 x_off, INT16 y_off,
         int ntrap, xTrap *traps)
@@ -817,7 +1449,7 @@ void Viv2DAddTraps(PicturePtr pPicture, INT16 x_off, INT16 y_off,
     Viv2DFinishAccess(pPix, EXA_PREPARE_DEST);
 }
 
-void Viv2DTriangles(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
+static void Viv2DFbTriangles(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
         PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntri, xTriangle *tri)
 {
     PixmapPtr pSrc = GetDrawablePixmap(pSrcPicture->pDrawable);
@@ -828,8 +1460,6 @@ void Viv2DTriangles(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
     if (pDst)
         Viv2DPrepareAccess(pDst, EXA_PREPARE_DEST);
 
-    VIV2D_DBG_MSG("Viv2DTriangles");
-
     fbTriangles(op, pSrcPicture, pDstPicture, maskFormat, xSrc, ySrc, ntri, tri);
 
     if (pDst)
@@ -838,8 +1468,49 @@ void Viv2DTriangles(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
         Viv2DFinishAccess(pSrc, EXA_PREPARE_SRC);
 }
 
-
-void Viv2DAddTriangles(PicturePtr pPicture, INT16 x_off, INT16 y_off,
+// Triangles: same as Trapezoids
+void Viv2DTriangles(CARD8 op, PicturePtr pSrcPicture, PicturePtr pDstPicture,
+        PictFormatPtr maskFormat, INT16 xSrc, INT16 ySrc, int ntri, xTriangle *tri)
+{
+    int src_dx, src_dy;
+
+    VIV2D_DBG_MSG("Viv2DTriangles");
+
+    if (ntri <= 0)
+        return;
+
+    if (!Viv2DCoverageSupported(pDstPicture, maskFormat))
+    {
+        Viv2DFbTriangles(op, pSrcPicture, pDstPicture, maskFormat, xSrc, ySrc, ntri, tri);
+        return;
+    }
+
+    src_dx = xSrc - (tri[0].p1.x >> 16);
+    src_dy = ySrc - (tri[0].p1.y >> 16);
+
+    for (int i = 0; i < ntri; i += maskFormat ? ntri : 1)
+    {
+        int n = maskFormat ? ntri : 1;
+        pixman_image_t *image;
+        BoxRec bounds;
+
+        miTriangleBounds(n, &tri[i], &bounds);
+        image = Viv2DCoverageImage(pDstPicture, &bounds);
+        if (!image)
+            continue;
+
+        pixman_add_triangles(image, -bounds.x1, -bounds.y1, n, (pixman_triangle_t *) &tri[i]);
+
+        if (!Viv2DCompositeCoverage(op, pSrcPicture, pDstPicture, image, &bounds, src_dx, src_dy))
+            Viv2DFbTriangles(op, pSrcPicture, pDstPicture, maskFormat,
+                    (tri[i].p1.x >> 16) + src_dx, (tri[i].p1.y >> 16) + src_dy, n, &tri[i]);
+
+        pixman_image_unref(image);
+    }
+}
+
+
+void Viv2DAddTriangles(PicturePtr pPicture, INT16 x_off, INT16 y_off,
         int ntri, xTriangle *tris)
 {
     PixmapPtr pPix = GetDrawablePixmap(pPicture->pDrawable);
@@ -849,6 +1520,255 @@ void Viv2DAddTriangles(PicturePtr pPicture, INT16 x_off, INT16 y_off,
     fbAddTriangles(pPicture, x_off, y_off, ntri, tris);
     Viv2DFinishAccess(pPix, EXA_PREPARE_DEST);
 }
+
+#ifdef VIV2D_GRADIENT
+/*
+ * Linear gradients along x or y only vary along their axis: one row (or
+ * column) of it is rasterized by pixman into a strip kept in a small lru
+ * cache, the DE stretches the strip over VIV2D_GRADIENT_ROWS and the wrapped
+ * Composite reads that as a repeating tile. Radial, conical and rotated
+ * gradients still go to the wrapped Composite as they are.
+ */
+
+static Bool Viv2DGradientSupported(PicturePtr pSrcPicture, PicturePtr pDstPicture,
+        int width, int height, Bool *vertical)
+{
+    PixmapPtr pDst = GetDrawablePixmap(pDstPicture->pDrawable);
+    struct ARMSOCPixmapPrivRec *armsocPix;
+    PictLinearGradient *lg;
+
+    if (!pSrcPicture || pSrcPicture->pDrawable || !pSrcPicture->pSourcePict ||
+            pSrcPicture->pSourcePict->type != SourcePictTypeLinear)
+        return FALSE;
+
+    if (pSrcPicture->transform || pSrcPicture->alphaMap || !width || !height)
+        return FALSE;
+
+    lg = &pSrcPicture->pSourcePict->linear;
+    if (lg->p1.y == lg->p2.y && lg->p1.x != lg->p2.x)
+        *vertical = FALSE;
+    else if (lg->p1.x == lg->p2.x && lg->p1.y != lg->p2.y)
+        *vertical = TRUE;
+    else
+        return FALSE;
+
+    if ((*vertical ? height : width) > VIV2D_GRADIENT_MAX_SIZE)
+        return FALSE;
+
+    armsocPix = pDst ? exaGetPixmapDriverPrivate(pDst) : NULL;
+    return armsocPix && armsocPix->priv && armsocPix->priv->bo;
+}
+
+static void Viv2DGradientStripFree(Viv2DRec *v2d, Viv2DGradientStrip *strip)
+{
+    if (strip->pix && strip->pix->bo)
+        _Viv2DOpDelTmpPix(v2d, strip->pix);
+    else
+        free(strip->pix);
+    free(strip->stops);
+    memset(strip, 0, sizeof(*strip));
+}
+
+static Bool Viv2DGradientStripMatch(Viv2DGradientStrip *strip, PictLinearGradient *lg,
+        int repeat, Bool vertical, int start, int len)
+{
+    return strip->stamp && strip->vertical == vertical && strip->repeat == repeat &&
+           strip->p1.x == lg->p1.x && strip->p1.y == lg->p1.y &&
+           strip->p2.x == lg->p2.x && strip->p2.y == lg->p2.y &&
+           strip->nstops == lg->nstops &&
+           !memcmp(strip->stops, lg->stops, lg->nstops * sizeof(*lg->stops)) &&
+           strip->start <= start && start + len <= strip->start + strip->len;
+}
+
+// strip covering start to start + len along the axis, from the cache or
+// rasterized into the least recently used slot
+static Viv2DGradientStrip *Viv2DGradientStripGet(Viv2DRec *v2d, PicturePtr pPicture,
+        Bool vertical, int x, int y, int len)
+{
+    PictLinearGradient *lg = &pPicture->pSourcePict->linear;
+    int repeat = pPicture->repeat ? pPicture->repeatType : RepeatNone;
+    int start = vertical ? y : x;
+    int width = vertical ? 1 : len;
+    int height = vertical ? len : 1;
+    Viv2DGradientStrip *strip = &v2d->gradient_cache[0];
+    pixman_image_t *gradient, *image;
+    uint8_t *src, *buf;
+    int src_pitch, xoff, yoff;
+
+    for (int i = 0; i < VIV2D_GRADIENT_CACHE_COUNT; i++)
+    {
+        Viv2DGradientStrip *s = &v2d->gradient_cache[i];
+
+        if (Viv2DGradientStripMatch(s, lg, repeat, vertical, start, len))
+        {
+            s->stamp = ++v2d->gradient_stamp;
+            return s;
+        }
+        if (s->stamp < strip->stamp)
+            strip = s;
+    }
+
+    Viv2DGradientStripFree(v2d, strip);
+
+    gradient = image_from_pict(pPicture, FALSE, &xoff, &yoff);
+    if (!gradient)
+        return NULL;
+
+    // pixel centers of x, y onwards, as pixman would do for the whole area
+    image = pixman_image_create_bits(PIXMAN_a8r8g8b8, width, height, NULL, 0);
+    if (image)
+        pixman_image_composite32(PIXMAN_OP_SRC, gradient, NULL, image,
+                x + xoff, y + yoff, 0, 0, 0, 0, width, height);
+    free_pixman_pict(pPicture, gradient);
+    if (!image)
+        return NULL;
+
+    strip->stops = malloc(lg->nstops * sizeof(*lg->stops));
+    strip->pix = _Viv2DOpCreateTmpPix(v2d, width, height, 32);
+    if (!strip->stops || !strip->pix || !strip->pix->bo)
+    {
+        Viv2DGradientStripFree(v2d, strip);
+        pixman_image_unref(image);
+        return NULL;
+    }
+    _Viv2DSetFormat(32, 32, &strip->pix->format);
+
+    // one sequential write into the write-combined strip
+    src = (uint8_t *) pixman_image_get_data(image);
+    src_pitch = pixman_image_get_stride(image);
+    buf = etna_bo_map(strip->pix->bo);
+
+    etna_bo_cpu_prep(strip->pix->bo, DRM_ETNA_PREP_WRITE);
+    for (int i = 0; i < height; i++)
+    {
+        memcpy(buf, src, width * 4);
+        src += src_pitch;
+        buf += strip->pix->pitch;
+    }
+    etna_bo_cpu_fini(strip->pix->bo);
+    pixman_image_unref(image);
+
+    memcpy(strip->stops, lg->stops, lg->nstops * sizeof(*lg->stops));
+    strip->nstops = lg->nstops;
+    strip->p1 = lg->p1;
+    strip->p2 = lg->p2;
+    strip->repeat = repeat;
+    strip->vertical = vertical;
+    strip->start = start;
+    strip->len = len;
+    strip->stamp = ++v2d->gradient_stamp;
+
+    VIV2D_DBG_MSG("Viv2DGradientStripGet %s start:%d len:%d stops:%d",
+            vertical ? "vertical" : "horizontal", start, len, lg->nstops);
+
+    return strip;
+}
+
+// the gradient over width x height at x, y as a gpu picture read from 0, 0:
+// the strip stretched across at most VIV2D_GRADIENT_ROWS, repeating beyond
+static PicturePtr Viv2DGradientPicture(ScreenPtr pScreen, PicturePtr pSrcPicture,
+        Bool vertical, int x, int y, int width, int height)
+{
+    Viv2DRec *v2d = Viv2DPrivFromScreen(pScreen);
+    PictFormatPtr format = PictureMatchFormat(pScreen, 32, PICT_a8r8g8b8);
+    int len = vertical ? height : width;
+    int across = vertical ? width : height;
+    int rows = min(across, VIV2D_GRADIENT_ROWS);
+    struct ARMSOCPixmapPrivRec *armsocPix;
+    Viv2DGradientStrip *strip;
+    Viv2DPixmapPrivPtr pix;
+    PixmapPtr pPixmap;
+    PicturePtr pPicture;
+    Viv2DRect rect;
+    XID repeat = RepeatNormal;
+    int off, error;
+
+    if (!format)
+        return NULL;
+
+    strip = Viv2DGradientStripGet(v2d, pSrcPicture, vertical, x, y, len);
+    if (!strip)
+        return NULL;
+
+    pPixmap = pScreen->CreatePixmap(pScreen, vertical ? rows : len, vertical ? len : rows,
+            32, CREATE_PIXMAP_USAGE_SCRATCH);
+    if (!pPixmap)
+        return NULL;
+
+    armsocPix = exaGetPixmapDriverPrivate(pPixmap);
+    pix = armsocPix ? armsocPix->priv : NULL;
+    if (!pix || !pix->bo)
+    {
+        pScreen->DestroyPixmap(pPixmap);
+        return NULL;
+    }
+
+    off = (vertical ? y : x) - strip->start;
+    rect.x1 = 0;
+    rect.y1 = 0;
+    rect.x2 = pix->width;
+    rect.y2 = pix->height;
+
+    _Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_SRC_STRETCH_RES + VIV2D_DEST_RES +
+            VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
+    _Viv2DStreamSrc(v2d, strip->pix);
+    if (vertical)
+    {
+        _Viv2DStreamSrcOrigin(v2d, 0, off, 1, len);
+        _Viv2DStreamStretchFactor(v2d, 1, len, rows, len);
+    }
+    else
+    {
+        _Viv2DStreamSrcOrigin(v2d, off, 0, len, 1);
+        _Viv2DStreamStretchFactor(v2d, len, 1, len, rows);
+    }
+    _Viv2DStreamDst(v2d, pix, VIVS_DE_DEST_CONFIG_COMMAND_STRETCH_BLT, ROP_SRC, NULL);
+    _Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0);
+    _Viv2DStreamRects(v2d, &rect, 1);
+    _Viv2DStreamCacheFlush(v2d);
+
+    pix->refcnt++;
+    exaMarkSync(pScreen);
+
+    pPicture = CreatePicture(0, &pPixmap->drawable, format, rows < across ? CPRepeat : 0,
+            &repeat, serverClient, &error);
+
+    // the picture keeps its own reference
+    pScreen->DestroyPixmap(pPixmap);
+
+    VIV2D_DBG_MSG("Viv2DGradientPicture %dx%d at %dx%d rows:%d", width, height, x, y, rows);
+
+    return pPicture;
+}
+
+// Composite: supported gradient sources are swapped for their gpu picture
+static void Viv2DGradientComposite(CARD8 op, PicturePtr pSrcPicture, PicturePtr pMaskPicture,
+        PicturePtr pDstPicture, INT16 xSrc, INT16 ySrc, INT16 xMask, INT16 yMask,
+        INT16 xDst, INT16 yDst, CARD16 width, CARD16 height)
+{
+    ScreenPtr pScreen = pDstPicture->pDrawable->pScreen;
+    PictureScreenPtr ps = GetPictureScreen(pScreen);
+    Viv2DRec *v2d = Viv2DPrivFromScreen(pScreen);
+    PicturePtr pGradient = NULL;
+    Bool vertical;
+
+    if (Viv2DGradientSupported(pSrcPicture, pDstPicture, width, height, &vertical))
+        pGradient = Viv2DGradientPicture(pScreen, pSrcPicture, vertical, xSrc, ySrc, width, height);
+
+    ps->Composite = v2d->Composite;
+    if (pGradient)
+    {
+        ps->Composite(op, pGradient, pMaskPicture, pDstPicture, 0, 0,
+                xMask, yMask, xDst, yDst, width, height);
+        FreePicture(pGradient, 0);
+    }
+    else
+        ps->Composite(op, pSrcPicture, pMaskPicture, pDstPicture, xSrc, ySrc,
+                xMask, yMask, xDst, yDst, width, height);
+    v2d->Composite = ps->Composite;
+    ps->Composite = Viv2DGradientComposite;
+}
+#endif
 #endif
 
 
@@ -859,6 +1779,51 @@ static Viv2DPixmapPrivPtr Viv2DPixmapPrivFromPixmap(PixmapPtr pPixmap)
 }
 
 
+/**
+ * Submit the gpu work still queued for pPixmap without waiting and return
+ * a sync_file fd signaled once it is done, or -1 when the pixmap has no
+ * pending gpu work known to us. Used to put the scanout of a pixmap behind
+ * its rendering instead of blocking the server on it.
+ */
+static int Viv2DFlushFence(struct ARMSOCEXARec *exa, PixmapPtr pPixmap)
+{
+	Viv2DEXAPtr v2d_exa = (Viv2DEXAPtr) exa;
+	Viv2DRec *v2d = v2d_exa->v2d;
+	Viv2DPixmapPrivPtr pix = Viv2DPixmapPrivFromPixmap(pPixmap);
+	int fence_fd = -1;
+
+	if (!pix || !pix->bo || !pix->batch)
+		return -1;
+
+	if (pix->batch != v2d->batch_serial) {
+		int i;
+
+		// already submitted: still in the ring means it may be in flight,
+		// older batches are done or implicitly fenced by the kernel
+		_Viv2DStreamSync(v2d);
+		for (i = 0; i < VIV2D_STREAM_COUNT; i++) {
+			if (v2d->stream_fence[i] && v2d->stream_serial[i] == pix->batch)
+				break;
+		}
+		if (i == VIV2D_STREAM_COUNT)
+			return -1;
+
+		// the pipe executes submits in order, an empty batch submitted now
+		// signals after the one of the pixmap
+		if (etna_cmd_stream_offset(v2d->stream) == 0) {
+			_Viv2DStreamReserve(v2d, 2);
+			etna_nop(v2d->stream);
+			etna_nop(v2d->stream);
+		}
+	}
+
+	_Viv2DStreamSubmitFence(v2d, &fence_fd);
+	etna_bo_cache_clean(v2d->dev);
+
+	return fence_fd;
+}
+
+
 /**
  * PixmapIsOffscreen() is an optional driver replacement to
  * exaPixmapHasGpuCopy(). Set to NULL if you want the standard behaviour
@@ -942,6 +1907,12 @@ static void Viv2DDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
 
     Viv2DDetachBo(pARMSOC, priv);
 
+#ifdef VIV2D_ACCESS_REGION
+    // normally gone with the drawable already, the closure is freed below
+    if (pix && pix->damage)
+        DamageDestroy(pix->damage);
+#endif
+
     free(pix);
 
     priv->priv = NULL;
@@ -1006,6 +1977,12 @@ static Bool Viv2DModifyPixmapHeader(PixmapPtr pPixmap,
     VIV2D_DBG_MSG("Viv2DModifyPixmapHeader pix:%p %dx%d depth:%d bpp:%d pix_depth:%d pix_bpp:%d",
             pix, width, height, depth, bitsPerPixel, pPixmap->drawable.depth, pPixmap->drawable.bitsPerPixel);
 
+#ifdef VIV2D_SOLID_CACHE
+    // new storage or geometry
+    if (pix)
+        pix->solid_known = FALSE;
+#endif
+
     if (LS_ModifyPixmapHeader(pPixmap, width, height, depth, bitsPerPixel, devKind, pPixData))
     {
         dumb_bo_map(pARMSOC->scanout->fd, pARMSOC->scanout);
@@ -1103,6 +2080,108 @@ static Bool Viv2DModifyPixmapHeader(PixmapPtr pPixmap,
  */
 
 #ifdef VIV2D_UPLOAD_TO_SCREEN
+/*
+ * size bytes in the staging ring at *offset of *bo. never waits for the
+ * gpu: the current bo is filled up, then the next one is taken if the gpu
+ * is done reading it, FALSE otherwise. no cpu_prep, only parts the gpu does
+ * not read are written and prep would wait for the rest.
+ */
+static Bool Viv2DStagingGet(Viv2DRec *v2d, uint32_t size, struct etna_bo **bo, uint32_t *offset)
+{
+    Viv2DStaging *st = &v2d->staging[v2d->cur_staging];
+    uint32_t start = ALIGN(st->used, VIV2D_UPLOAD_STAGING_ALIGN);
+
+    if (size > VIV2D_UPLOAD_STAGING_SIZE)
+        return FALSE;
+
+    if (!st->bo || start + size > VIV2D_UPLOAD_STAGING_SIZE)
+    {
+        int next = (v2d->cur_staging + 1) % VIV2D_UPLOAD_STAGING_COUNT;
+
+        st = &v2d->staging[next];
+        if (!st->bo)
+        {
+            st->bo = etna_bo_new(v2d->dev, VIV2D_UPLOAD_STAGING_SIZE, ETNA_BO_WC);
+            if (!st->bo)
+                return FALSE;
+            st->map = etna_bo_map(st->bo);
+        }
+        else if (!etna_bo_idle(st->bo, ETNA_PREP_WRITE))
+            return FALSE;
+
+        v2d->cur_staging = next;
+        start = 0;
+    }
+
+    st->used = start + size;
+    *bo = st->bo;
+    *offset = start;
+    return TRUE;
+}
+
+static void Viv2DStagingFini(Viv2DRec *v2d)
+{
+    for (int i = 0; i < VIV2D_UPLOAD_STAGING_COUNT; i++)
+    {
+        if (v2d->staging[i].bo)
+            etna_bo_del(v2d->staging[i].bo);
+    }
+}
+
+#ifdef VIV2D_USERPTR
+// forget the client memory imports, their bos go once the gpu is done.
+// the memory may be unmapped and mapped again at the same address after
+// the clients got their replies
+static void Viv2DUserptrDrop(Viv2DRec *v2d)
+{
+    for (int i = 0; i < VIV2D_USERPTR_CACHE_COUNT; i++)
+    {
+        Viv2DUserptr *u = &v2d->userptr[i];
+
+        if (u->stamp)
+            etna_bo_cache_usermem_del(v2d->dev, u->bo);
+        memset(u, 0, sizeof(*u));
+    }
+}
+
+// bo of the pages holding src, imported once and reused by the uploads
+// inside of it, each clip box of a PutImage is one
+static struct etna_bo *Viv2DUserptrGet(Viv2DRec *v2d, char *src, size_t size, uintptr_t *start)
+{
+    uintptr_t first = (uintptr_t)src & PAGE_MASK;
+    uintptr_t last = PAGE_ALIGN((uintptr_t)src + size);
+    Viv2DUserptr *u = &v2d->userptr[0];
+
+    for (int i = 0; i < VIV2D_USERPTR_CACHE_COUNT; i++)
+    {
+        Viv2DUserptr *c = &v2d->userptr[i];
+
+        if (c->stamp && c->start <= first && last <= c->start + c->size)
+        {
+            c->stamp = ++v2d->userptr_stamp;
+            *start = c->start;
+            return c->bo;
+        }
+        if (c->stamp < u->stamp)
+            u = c;
+    }
+
+    if (u->stamp)
+        etna_bo_cache_usermem_del(v2d->dev, u->bo);
+    memset(u, 0, sizeof(*u));
+
+    u->bo = etna_bo_from_usermem_prot(v2d->dev, (void *)first, last - first, ETNA_USERPTR_READ);
+    if (!u->bo)
+        return NULL;
+
+    u->start = first;
+    u->size = last - first;
+    u->stamp = ++v2d->userptr_stamp;
+    *start = first;
+    return u->bo;
+}
+#endif
+
 static Bool Viv2DUploadToScreen(PixmapPtr pDst,
         int x, int y, int w, int h, char *src, int src_pitch)
 {
@@ -1110,15 +2189,14 @@ static Bool Viv2DUploadToScreen(PixmapPtr pDst,
     struct ARMSOCRec *pARMSOC = ARMSOCPTR(pScrn);
     Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
     Viv2DPixmapPrivPtr dst = Viv2DPixmapPrivFromPixmap(pDst);
+    int cpp = pDst->drawable.bitsPerPixel / 8;
+    int row = w * cpp;
+    Viv2DPixmapPrivRec tmp = { 0 };
+    Viv2DPixmapPrivPtr scratch = NULL;
     Viv2DRect rects[1];
-    int height = h;
-    Viv2DPixmapPrivPtr tmp;
-    int pitch;
-    char *src_buf, *buf;
-    Viv2DFormat tmp_fmt;
-    int use_usermem = 0;
     int src_x = 0;
     int src_y = 0;
+    Bool use_usermem = FALSE;
 
     if (w * h < 4)
         return FALSE;
@@ -1133,125 +2211,102 @@ static Bool Viv2DUploadToScreen(PixmapPtr pDst,
         return FALSE;
     }
 #endif
+#ifdef VIV2D_SUPPORT_MONO
+    if (dst->format.fmt == DE_FORMAT_MONOCHROME)
+        return FALSE;
+#endif
 
-#ifndef VIV2D_SUPPORT_A8_DST
+#ifdef VIV2D_SUPPORT_A8_DST
+    if (dst->format.fmt == DE_FORMAT_A8 && !v2d->a8_target)
+#else
     if (dst->format.fmt == DE_FORMAT_A8)
+#endif
     {
         // VIV2D_UNSUPPORTED_MSG("Viv2DUploadToScreen unsupported dst A8 dst:%p/%p", pDst, dst);
         return FALSE;
     }
-#endif
 
-    tmp_fmt = dst->format;
+    tmp.format = dst->format;
+    tmp.width = w;
+    tmp.height = h;
 
 #ifdef VIV2D_USERPTR
-
-    uintptr_t page_start = ((uintptr_t)src / (PAGE_SIZE * src_pitch)) * (PAGE_SIZE * src_pitch);
-    char *start_buf = (char *)page_start;
-
-    src_x = (((uintptr_t)src - page_start) % src_pitch) / 4;
-    src_y = (((uintptr_t)src - page_start) / src_pitch);
-    size_t aligned_size = PAGE_ALIGN(src_pitch * (h + src_y + 1));
-
-    VIV2D_INFO_MSG("Viv2DUploadToScreen page aligned %p/%p %dx%d %x", start_buf, src, src_x, src_y, aligned_size);
-
-    //	src_x = 0;
-    //	src_y = 0;
-    if (aligned_size < 1024 * 1024 * 16)
+    // read in place, the src rows are addressed from the first page
+    if (row * h >= VIV2D_USERPTR_MIN_SIZE && src_pitch % cpp == 0)
     {
+        uintptr_t start;
 
-        VIV2D_INFO_MSG("Viv2DUploadToScreen page aligned %p %dx%d", src, src_x, src_y);
-        struct etna_bo *aligned_bo = etna_bo_from_usermem_prot(v2d->dev, start_buf, aligned_size, ETNA_USERPTR_READ);
-        if (aligned_bo)
-        {
-            tmp = calloc(sizeof (*tmp), 1);
-            VIV2D_INFO_MSG("Viv2DUploadToScreen create usermem %p/%p %d %dx%d:%dx%d %x",
-                    start_buf, src, src_pitch, src_x, src_y, w, h, aligned_size);
-            tmp->bo = aligned_bo;
-            tmp->width = w;
-            tmp->height = h;
-            tmp->pitch = src_pitch;
-            use_usermem = 1;
-        }
-        else
+        tmp.bo = Viv2DUserptrGet(v2d, src, (size_t)(h - 1) * src_pitch + row, &start);
+        if (tmp.bo)
         {
-            src_x = 0;
-            src_y = 0;
-            VIV2D_INFO_MSG("Viv2DUploadToScreen cannot create usermem");
-            tmp = _Viv2DOpCreateTmpPix(v2d, w, h, pDst->drawable.bitsPerPixel);
+            tmp.pitch = src_pitch;
+            src_x = (((uintptr_t)src - start) % src_pitch) / cpp;
+            src_y = ((uintptr_t)src - start) / src_pitch;
+            use_usermem = TRUE;
         }
     }
-    else
-    {
-        src_x = 0;
-        src_y = 0;
-        VIV2D_INFO_MSG("Viv2DUploadToScreen cannot create usermem : two large alignement %ld", aligned_size);
-        tmp = _Viv2DOpCreateTmpPix(v2d, w, h, pDst->drawable.bitsPerPixel);
-    }
-#else
-    tmp = _Viv2DOpCreateTmpPix(v2d, w, h, pDst->drawable.bitsPerPixel);
 #endif
 
-    tmp->format = tmp_fmt;
-
-    dst->refcnt++;
-
     if (!use_usermem)
     {
+        char *buf;
 
-        if (pitch == src_pitch)
-            VIV2D_INFO_MSG("SAME PITCH %d", pitch);
-
-        pitch = tmp->pitch;
-
-        src_buf = src ;
-        buf = (char *) etna_bo_map(tmp->bo);
-
-
-        while (height--) {
-            memcpy(buf, src_buf, pitch);
-            src_buf += src_pitch;
-            buf += pitch;
+        tmp.pitch = ALIGN(row, VIV2D_PITCH_ALIGN);
+        if (Viv2DStagingGet(v2d, tmp.pitch * h, &tmp.bo, &tmp.offset))
+        {
+            buf = (char *) v2d->staging[v2d->cur_staging].map + tmp.offset;
+        }
+        else
+        {
+            // ring busy, a scratch from the bo cache does not wait either
+            scratch = _Viv2DOpCreateTmpPix(v2d, w, h, pDst->drawable.bitsPerPixel);
+            if (!scratch || !scratch->bo)
+            {
+                free(scratch);
+                return FALSE;
+            }
+            tmp.bo = scratch->bo;
+            buf = (char *) etna_bo_map(tmp.bo);
         }
 
+        // one sequential write into write-combined memory
+        for (int i = 0; i < h; i++)
+        {
+            memcpy(buf, src, row);
+            src += src_pitch;
+            buf += tmp.pitch;
+        }
     }
 
+    dst->refcnt++;
+
     rects[0].x1 = x;
     rects[0].y1 = y;
     rects[0].x2 = x + w;
     rects[0].y2 = y + h;
 
     _Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
-    _Viv2DStreamSrc(v2d, tmp); // tmp source
-    _Viv2DStreamSrcOrigin(v2d, src_x, src_y, tmp->width, tmp->height); // tmp source
+    _Viv2DStreamSrc(v2d, &tmp);
+    _Viv2DStreamSrcOrigin(v2d, src_x, src_y, w, h);
     _Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
     _Viv2DStreamBlendOp(v2d, NULL, 0, 0, FALSE, FALSE);
     _Viv2DStreamRects(v2d, rects, 1);
 
     _Viv2DStreamCacheFlush(v2d);
 
-    VIV2D_INFO_MSG("Viv2DUploadToScreen blit done dst:%p/%p bo:%p buf:%p src_buf:%p(%d/%d) %dx%d(%dx%d) %dx%d %d/%d",
-            pDst, dst, dst->bo, etna_bo_map(dst->bo),
-            src, src_pitch, tmp->pitch, x, y, w, h,
-            pDst->drawable.width, pDst->drawable.height,
-            pDst->drawable.depth, pDst->drawable.bitsPerPixel);
+    VIV2D_DBG_MSG("Viv2DUploadToScreen dst:%p/%p bo:%p %dx%d(%dx%d) pitch:%d/%d usermem:%d scratch:%p",
+            pDst, dst, dst->bo, x, y, w, h, src_pitch, tmp.pitch, use_usermem, scratch);
 
 #ifdef VIV2D_USERPTR
+    // the memory is the client's again once we return. the pipe runs
+    // submits in order, waiting for this one waits for the copy
     if (use_usermem)
-    {
-        _Viv2DStreamCommit(v2d, TRUE);
-        etna_bo_wait(v2d->dev, v2d->pipe, tmp->bo, 5000000000);
-        etna_bo_del(tmp->bo);
-        free(tmp);
-    }
-    else
-    {
-        _Viv2DOpDelTmpPix(v2d, tmp);
-    }
-#else
-    _Viv2DOpDelTmpPix(v2d, tmp);
+        _Viv2DStreamCommit(v2d, FALSE);
 #endif
 
+    if (scratch)
+        _Viv2DOpDelTmpPix(v2d, scratch);
+
     exaMarkSync(pDst->drawable.pScreen);
 
     return TRUE;
@@ -1290,19 +2345,57 @@ static Bool Viv2DUploadToScreen(PixmapPtr pDst,
  * DownloadFromScreen() is not required, but is highly recommended.
  */
 
+/*
+ * cached bo of at least size bytes for readbacks, of a power of two size.
+ * cpu_prep invalidates the whole bo, a bo at most twice the copy keeps
+ * that close to the copied range. only the size class of the last
+ * readback is kept, a readback of another class replaces it
+ */
+static struct etna_bo *Viv2DReadbackBo(Viv2DRec *v2d, uint32_t size)
+{
+    uint32_t class_size = VIV2D_READBACK_MIN_SIZE;
+    int i = 0;
+
+    while (class_size < size)
+    {
+        if (++i == VIV2D_READBACK_CLASSES)
+            return NULL;
+        class_size <<= 1;
+    }
+
+    if (v2d->readback && v2d->readback_size != class_size)
+    {
+        etna_bo_del(v2d->readback);
+        v2d->readback = NULL;
+    }
+
+    if (!v2d->readback)
+    {
+        v2d->readback = etna_bo_new(v2d->dev, class_size, ETNA_BO_CACHED);
+        v2d->readback_size = class_size;
+    }
+
+    return v2d->readback;
+}
+
+static void Viv2DReadbackFini(Viv2DRec *v2d)
+{
+    if (v2d->readback)
+        etna_bo_del(v2d->readback);
+    v2d->readback = NULL;
+}
+
 static Bool Viv2DDownloadFromScreen(PixmapPtr pSrc,
     int x, int y, int w, int h, char *dst, int dst_pitch)
 {
-
-    int i, pitch;
     ScrnInfoPtr pScrn = pix2scrn(pSrc);
     struct ARMSOCRec *pARMSOC = ARMSOCPTR(pScrn);
     Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
     Viv2DPixmapPrivPtr src = Viv2DPixmapPrivFromPixmap(pSrc);
+    int row = w * pSrc->drawable.bitsPerPixel / 8;
+    Viv2DPixmapPrivRec tmp = { 0 };
     Viv2DRect rects[1];
-    Viv2DPixmapPrivPtr tmp;
-    char *dst_buf, *src_buf, *buf;
-    Viv2DFormat tmp_fmt;
+    char *buf;
 
     if (w * h < 4)
         return FALSE;
@@ -1312,65 +2405,123 @@ static Bool Viv2DDownloadFromScreen(PixmapPtr pSrc,
 #ifdef VIV2D_PREPARE_SET_FORMAT
     if (!_Viv2DSetFormat(pSrc->drawable.depth, pSrc->drawable.bitsPerPixel, &src->format))
     {
-        VIV2D_UNSUPPORTED_MSG("Viv2DUploadToScreen unsupported src format %d/%d %p", 
+        VIV2D_UNSUPPORTED_MSG("Viv2DDownloadFromScreen unsupported src format %d/%d %p",
                 pSrc->drawable.depth, pSrc->drawable.bitsPerPixel, src);
         return FALSE;
     }
 #endif
+#ifdef VIV2D_SUPPORT_MONO
+    // the staging copy would be a mono destination
+    if (src->format.fmt == DE_FORMAT_MONOCHROME)
+        return FALSE;
+#endif
+    // and an a8 one
+#ifdef VIV2D_SUPPORT_A8_DST
+    if (src->format.fmt == DE_FORMAT_A8 && !v2d->a8_target)
+#else
+    if (src->format.fmt == DE_FORMAT_A8)
+#endif
+        return FALSE;
 
-    tmp_fmt = src->format;
-    tmp = _Viv2DOpCreateTmpPix(v2d, w, h, pSrc->drawable.bitsPerPixel);
-    tmp->format = tmp_fmt;
-
-    pitch = tmp->pitch;
+    tmp.format = src->format;
+    tmp.width = w;
+    tmp.height = h;
+    tmp.pitch = ALIGN(row, VIV2D_PITCH_ALIGN);
+    tmp.bo = Viv2DReadbackBo(v2d, tmp.pitch * h);
+    if (!tmp.bo)
+        return FALSE;
 
-    rects[0].x1 = x;
-    rects[0].y1 = y;
-    rects[0].x2 = x + w;
-    rects[0].y2 = y + h;
+    rects[0].x1 = 0;
+    rects[0].y1 = 0;
+    rects[0].x2 = w;
+    rects[0].y2 = h;
 
     _Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1));
     _Viv2DStreamSrc(v2d, src);
-    _Viv2DStreamSrcOrigin(v2d, 0, 0, tmp->width, tmp->height);
-    _Viv2DStreamDst(v2d, tmp, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+    _Viv2DStreamSrcOrigin(v2d, x, y, w, h);
+    _Viv2DStreamDst(v2d, &tmp, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
     _Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0);
     _Viv2DStreamRects(v2d, rects, 1);
 
+    // waits for this blit only, then invalidates the cpu cache over the bo
     _Viv2DStreamCommit(v2d, TRUE);
-    _Viv2DStreamWait(v2d);
-
-    etna_bo_cpu_prep(tmp->bo, DRM_ETNA_PREP_READ);
+    _Viv2DStreamSync(v2d);
+    if (etna_bo_cpu_prep(tmp.bo, DRM_ETNA_PREP_READ))
+    {
+        VIV2D_INFO_MSG("Viv2DDownloadFromScreen wait bo:%p failed", tmp.bo);
+        return FALSE;
+    }
 
-    dst_buf = dst;
-    src_buf = (char *) etna_bo_map(tmp->bo);
-    buf = src_buf;
+    buf = (char *) etna_bo_map(tmp.bo);
 
-    for (i = 0; i < h; i++)
+    // cached reads, one copy when the rows are contiguous on both sides
+    if (dst_pitch == row && tmp.pitch == row)
     {
-        memcpy(dst_buf, buf, pitch);
-        dst_buf += dst_pitch;
-        buf += pitch;
+        memcpy(dst, buf, row * h);
+    }
+    else
+    {
+        for (int i = 0; i < h; i++)
+        {
+            memcpy(dst, buf, row);
+            dst += dst_pitch;
+            buf += tmp.pitch;
+        }
     }
 
-    etna_bo_cpu_fini(tmp->bo);
-
-    VIV2D_INFO_MSG("Viv2DDownloadFromScreen blit done %p %p %p(%d/%d) %dx%d(%dx%d) %dx%d %d/%d",
-            pSrc, etna_bo_map(src->bo), src, pitch, tmp->pitch, x, y, w, h,
-            pSrc->drawable.width, pSrc->drawable.height,
-            pSrc->drawable.depth, pSrc->drawable.bitsPerPixel);
+    etna_bo_cpu_fini(tmp.bo);
 
-    _Viv2DOpDelTmpPix(v2d, tmp);
+    VIV2D_DBG_MSG("Viv2DDownloadFromScreen src:%p/%p bo:%p %dx%d(%dx%d) pitch:%d/%d",
+            pSrc, src, src->bo, x, y, w, h, dst_pitch, tmp.pitch);
 
     return TRUE;
 }
 #endif
 
-#ifdef VIV2D_SOLID
-/** @name Solid
- * @{
- */
-/**
- * PrepareSolid() sets up the driver for doing a solid fill.
+#ifdef VIV2D_ROP
+// X11 GX functions as DE ROP codes, source is 0xcc, dest is 0xaa
+static const uint8_t viv2d_copy_rop[16] = {
+    ROP_BLACK,                // GXclear
+    ROP_DST_AND_SRC,          // GXand
+    ROP_SRC_AND_NOT_DST,      // GXandReverse
+    ROP_SRC,                  // GXcopy
+    ROP_NOT_SRC_AND_DST,      // GXandInverted
+    ROP_DST,                  // GXnoop
+    ROP_DST_XOR_SRC,          // GXxor
+    ROP_DST_OR_SRC,           // GXor
+    ROP_NOT_SRC_AND_NOT_DST,  // GXnor
+    ROP_NOT_SRC_XOR_DST,      // GXequiv
+    ROP_NOT_DST,              // GXinvert
+    ROP_SRC_OR_NOT_DST,       // GXorReverse
+    ROP_NOT_SRC,              // GXcopyInverted
+    ROP_NOT_SRC_OR_DST,       // GXorInverted
+    ROP_NOT_SRC_OR_NOT_DST,   // GXnand
+    ROP_WHITE,                // GXset
+};
+
+// same with the pattern (brush) in place of the source, pattern is 0xf0
+static const uint8_t viv2d_solid_rop[16] = {
+    0x00, 0xa0, 0x50, 0xf0, 0x0a, 0xaa, 0x5a, 0xfa,
+    0x05, 0xa5, 0x55, 0xf5, 0x0f, 0xaf, 0x5f, 0xff,
+};
+
+#define ROP_PATTERN_AND_DST 0xa0
+#define ROP_PATTERN_XOR_DST 0x5a
+
+// bitwise GX function of s and d
+static inline uint32_t Viv2DGXApply(int alu, uint32_t s, uint32_t d)
+{
+    return (alu & 8 ? ~s & ~d : 0) | (alu & 4 ? ~s & d : 0) |
+        (alu & 2 ? s & ~d : 0) | (alu & 1 ? s & d : 0);
+}
+#endif
+
+#ifdef VIV2D_SOLID
+/** @name Solid
+ * @{
+ */
+/**
+ * PrepareSolid() sets up the driver for doing a solid fill.
  * @param pPixmap Destination pixmap
  * @param alu raster operation
  * @param planemask write mask for the fill
@@ -1398,12 +2549,16 @@ static Bool Viv2DPrepareSolid (PixmapPtr pPixmap, int alu, Pixel planemask, Pixe
     Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
     Viv2DPixmapPrivPtr dst = Viv2DPixmapPrivFromPixmap(pPixmap);
 
+#ifdef VIV2D_PLACEMENT
+    Viv2DPixmapToGpu(v2d, pPixmap);
+#endif
     if (!dst->bo)
     {
         // CPU only
         return FALSE;
     }
 
+#ifndef VIV2D_ROP
     if (alu != GXcopy)
     {
         VIV2D_UNSUPPORTED_MSG("Viv2DPrepareSolid unsupported alu dst:%p/%p alu:%d",
@@ -1417,6 +2572,7 @@ static Bool Viv2DPrepareSolid (PixmapPtr pPixmap, int alu, Pixel planemask, Pixe
                 pPixmap, dst, (uint32_t)planemask);
         return FALSE;
     }
+#endif
 
 #ifdef VIV2D_PREPARE_SET_FORMAT
     if (!_Viv2DSetFormat(pPixmap->drawable.depth, pPixmap->drawable.bitsPerPixel, &dst->format))
@@ -1426,7 +2582,18 @@ static Bool Viv2DPrepareSolid (PixmapPtr pPixmap, int alu, Pixel planemask, Pixe
         return FALSE;
     }
 #endif
-#ifndef VIV2D_SUPPORT_A8_DST
+#ifdef VIV2D_SUPPORT_MONO
+    // mono is a source format only
+    if (dst->format.fmt == DE_FORMAT_MONOCHROME)
+        return FALSE;
+#endif
+#ifdef VIV2D_SUPPORT_A8_DST
+#ifndef VIV2D_ROP
+    // without an A8 target, fills need the rop path below
+    if (dst->format.fmt == DE_FORMAT_A8 && !v2d->a8_target)
+        return FALSE;
+#endif
+#else
     if (dst->format.fmt == DE_FORMAT_A8)
     {
         //		VIV2D_UNSUPPORTED_MSG("Viv2DPrepareSolid unsupported dst A8 dst:%p/%p  fg:%x", pPixmap, dst, fg);
@@ -1438,13 +2605,69 @@ static Bool Viv2DPrepareSolid (PixmapPtr pPixmap, int alu, Pixel planemask, Pixe
 
     _Viv2DOpInit(&v2d->op);
     v2d->op.mask = (uint32_t)planemask;
-    v2d->op.fg = Viv2DColour(fg, pPixmap->drawable.depth);
+    v2d->op.fg = Viv2DPixelColour(fg, pPixmap->drawable.depth);
     v2d->op.dst = dst;
 
+#ifdef VIV2D_SOLID_CACHE
+    // a plain fill leaves dst solid if it covers all of it, or if dst
+    // already has its color
+    v2d->op.solid_cache = alu == GXcopy && EXA_PM_IS_SOLID(&pPixmap->drawable, planemask);
+    v2d->op.solid_pixel = fg & FbFullMask(pPixmap->drawable.depth);
+    v2d->op.solid_cover = v2d->op.solid_cache && dst->solid_known && dst->solid == v2d->op.solid_pixel;
+    dst->solid_known = FALSE;
+#endif
+
     VIV2D_DBG_MSG("Viv2DPrepareSolid dst:%p/%p %dx%d, fg:%08x mask:%08x depth:%d alu:%d", pPixmap,
             dst, pPixmap->drawable.width, pPixmap->drawable.height, v2d->op.fg ,
             v2d->op.mask, pPixmap->drawable.depth, alu);
 
+#ifdef VIV2D_ROP
+#ifdef VIV2D_SUPPORT_A8_DST
+    if (dst->format.fmt == DE_FORMAT_A8 && !v2d->a8_target)
+    {
+        // no A8 target: fill a 32bpp view of the bo, 4 A8 pixels per view
+        // pixel, as dst = (dst & and) ^ xor on the bytes covered
+        uint8_t a = planemask & Viv2DGXApply(alu, fg, 0);
+        uint8_t b = (planemask & Viv2DGXApply(alu, fg, ~0)) | ~planemask;
+
+        v2d->op.a8_dst = dst;
+        v2d->op.a8_view = *dst;
+        v2d->op.a8_view.width = dst->pitch / 4;
+        _Viv2DSetFormat(32, 32, &v2d->op.a8_view.format);
+        v2d->op.dst = &v2d->op.a8_view;
+        v2d->op.solid_and_xor = TRUE;
+        v2d->op.and_color = (uint8_t)(a ^ b) * 0x01010101;
+        v2d->op.xor_color = a * 0x01010101;
+        return TRUE;
+    }
+#endif
+
+    if (!EXA_PM_IS_SOLID(&pPixmap->drawable, planemask))
+    {
+        // no write mask in the DE: with fg fixed, every dst bit either
+        // keeps, clears, sets or inverts, so the masked alu is
+        // dst = (dst & and) ^ xor, two brush passes over the rects
+        uint32_t a = planemask & Viv2DGXApply(alu, fg, 0);
+        uint32_t b = (planemask & Viv2DGXApply(alu, fg, ~0)) | ~planemask;
+
+        v2d->op.solid_and_xor = TRUE;
+        v2d->op.and_color = Viv2DPixelColour(a ^ b, pPixmap->drawable.depth);
+        v2d->op.xor_color = Viv2DPixelColour(a, pPixmap->drawable.depth);
+        return TRUE;
+    }
+
+    if (alu != GXcopy)
+    {
+        _Viv2DStreamReserve(v2d, VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_SRC_BRUSH_FILL_RES + VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES);
+        _Viv2DStreamEmptySrc(v2d);
+        _Viv2DStreamSrcOrigin(v2d, 0, 0, 0, 0);
+        _Viv2DStreamDst(v2d, v2d->op.dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, viv2d_solid_rop[alu], NULL);
+        _Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0); // reset blend
+        _Viv2DStreamBrushFill(v2d, v2d->op.fg);
+        return TRUE;
+    }
+#endif
+
 #ifdef VIV2D_SOLID_FILL_BRUSH
     _Viv2DStreamReserve(v2d, VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_SRC_BRUSH_FILL_RES + VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES);
 #else
@@ -1482,14 +2705,120 @@ static Bool Viv2DPrepareSolid (PixmapPtr pPixmap, int alu, Pixel planemask, Pixe
  *
  * This call is required if PrepareSolid() ever succeeds.
  */
+#ifdef VIV2D_ROP
+// stream dst = (dst & and_color) ^ xor_color over rects as brush passes,
+// with their own states. a zero and_color is a plain brush copy
+static void Viv2DSolidAndXor(Viv2DRec *v2d, Viv2DPixmapPrivPtr dst, Viv2DRect *rects, int cnt,
+        uint32_t and_color, uint32_t xor_color)
+{
+    if (!_Viv2DStreamReserve(v2d, 2 * (VIV2D_DEST_RES + VIV2D_SRC_BRUSH_FILL_RES + VIV2D_RECTS_RES(cnt)) +
+            VIV2D_BLEND_OFF_RES + VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES))
+        return;
+    _Viv2DStreamEmptySrc(v2d);
+    _Viv2DStreamSrcOrigin(v2d, 0, 0, 0, 0);
+    _Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0);
+
+    if (and_color == 0)
+    {
+        _Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, 0xf0, NULL);
+        _Viv2DStreamBrushFill(v2d, xor_color);
+        _Viv2DStreamRects(v2d, rects, cnt);
+        return;
+    }
+
+    _Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_PATTERN_AND_DST, NULL);
+    _Viv2DStreamBrushFill(v2d, and_color);
+    _Viv2DStreamRects(v2d, rects, cnt);
+
+    _Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_PATTERN_XOR_DST, NULL);
+    _Viv2DStreamBrushFill(v2d, xor_color);
+    _Viv2DStreamRects(v2d, rects, cnt);
+}
+
+static void Viv2DSolidAndXorRects(Viv2DRec *v2d)
+{
+    Viv2DOp *op = &v2d->op;
+
+    Viv2DSolidAndXor(v2d, op->dst, op->rects, op->cur_rect, op->and_color, op->xor_color);
+}
+
+#ifdef VIV2D_SUPPORT_A8_DST
+// A8 fill through the 32bpp view: the partial view pixels at the left and
+// right edges only touch their covered bytes and go out on their own
+static void Viv2DSolidA8View(Viv2DRec *v2d, int x1, int y1, int x2, int y2)
+{
+    Viv2DOp *op = &v2d->op;
+    int vx1 = x1 / 4;
+    int vx2 = (x2 + 3) / 4;
+    uint32_t lmask = 0xffffffff << (8 * (x1 & 3));
+    uint32_t rmask = 0xffffffff >> (8 * ((4 - (x2 & 3)) & 3));
+    Viv2DRect edge;
+
+    edge.y1 = y1;
+    edge.y2 = y2;
+
+    if (vx2 - vx1 == 1)
+        lmask &= rmask;
+
+    if (lmask != 0xffffffff)
+    {
+        edge.x1 = vx1;
+        edge.x2 = vx1 + 1;
+        Viv2DSolidAndXor(v2d, op->dst, &edge, 1, (op->and_color & lmask) | ~lmask, op->xor_color & lmask);
+        vx1++;
+    }
+
+    if (vx1 < vx2 && rmask != 0xffffffff)
+    {
+        edge.x1 = vx2 - 1;
+        edge.x2 = vx2;
+        Viv2DSolidAndXor(v2d, op->dst, &edge, 1, (op->and_color & rmask) | ~rmask, op->xor_color & rmask);
+        vx2--;
+    }
+
+    if (vx1 >= vx2)
+        return;
+
+    if (!_Viv2DOpGrowRects(op))
+    {
+        Viv2DSolidAndXorRects(v2d);
+        op->cur_rect = 0;
+    }
+    _Viv2DOpAddRect(op, vx1, y1, vx2 - vx1, y2 - y1);
+}
+#endif
+#endif
+
 static void Viv2DSolid (PixmapPtr pPixmap, int x1, int y1, int x2, int y2)
 {
     Viv2DRec *v2d = Viv2DPrivFromPixmap(pPixmap);
-    if (v2d->op.cur_rect >= VIV2D_MAX_RECTS)
+
+#ifdef VIV2D_SOLID_CACHE
+    if (x1 <= 0 && y1 <= 0 && x2 >= pPixmap->drawable.width && y2 >= pPixmap->drawable.height)
+        v2d->op.solid_cover = v2d->op.solid_cache;
+#endif
+
+#if defined(VIV2D_ROP) && defined(VIV2D_SUPPORT_A8_DST)
+    if (v2d->op.a8_dst)
     {
-        _Viv2DStreamReserve(v2d, VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
-        _Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
-        _Viv2DStreamCacheFlush(v2d);
+        Viv2DSolidA8View(v2d, x1, y1, x2, y2);
+        return;
+    }
+#endif
+
+    if (!_Viv2DOpGrowRects(&v2d->op))
+    {
+#ifdef VIV2D_ROP
+        if (v2d->op.solid_and_xor)
+        {
+            Viv2DSolidAndXorRects(v2d);
+        }
+        else
+#endif
+        {
+            if (_Viv2DStreamReserveOp(v2d, VIV2D_RECTS_RES(v2d->op.cur_rect)))
+                _Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
+        }
 
         v2d->op.cur_rect = 0;
     }
@@ -1518,13 +2847,43 @@ static void Viv2DDoneSolid (PixmapPtr pPixmap)
 
     Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 
-    if (v2d->op.cur_rect > 0)
+    // a single PE cache flush for the whole op
+#ifdef VIV2D_ROP
+    if (v2d->op.solid_and_xor)
     {
-        _Viv2DStreamReserve(v2d, VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
-        _Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
-        _Viv2DStreamCacheFlush(v2d);
+        Viv2DSolidAndXorRects(v2d);
+        if (_Viv2DStreamReserveOp(v2d, VIV2D_CACHE_FLUSH_RES))
+            _Viv2DStreamCacheFlush(v2d);
+    }
+    else
+#endif
+    {
+        if (_Viv2DStreamReserveOp(v2d, VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES))
+        {
+            _Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
+            _Viv2DStreamCacheFlush(v2d);
+        }
     }
 
+#if defined(VIV2D_ROP) && defined(VIV2D_SUPPORT_A8_DST)
+    // the view took the batch, not the pixmap
+    if (v2d->op.a8_dst)
+    {
+        v2d->op.a8_dst->batch = v2d->batch_serial;
+        v2d->op.dst = v2d->op.a8_dst;
+        v2d->op.a8_dst = NULL;
+    }
+#endif
+
+#ifdef VIV2D_SOLID_CACHE
+    // after the states streamed above dropped it
+    if (v2d->op.solid_cover)
+    {
+        v2d->op.dst->solid_known = TRUE;
+        v2d->op.dst->solid = v2d->op.solid_pixel;
+    }
+#endif
+
     VIV2D_DBG_MSG("Viv2DDoneSolid dst:%p/%p %d", pPixmap, v2d->op.dst, v2d->stream->offset);
 
 #ifdef VIV2D_TRACE
@@ -1587,19 +2946,26 @@ static Bool Viv2DPrepareCopy (PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap,
     Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
     Viv2DPixmapPrivPtr src = Viv2DPixmapPrivFromPixmap(pSrcPixmap);
     Viv2DPixmapPrivPtr dst = Viv2DPixmapPrivFromPixmap(pDstPixmap);
+    int rop = ROP_SRC;
 
+#ifdef VIV2D_PLACEMENT
+    Viv2DPixmapToGpu(v2d, pSrcPixmap);
+    Viv2DPixmapToGpu(v2d, pDstPixmap);
+#endif
     if (!src->bo || !dst->bo)
     {
         // CPU only
         return FALSE;
     }
 
-    if (alu != GXcopy)
+#ifndef VIV2D_ROP
+    if (alu != GXcopy || !EXA_PM_IS_SOLID(&pDstPixmap->drawable, planemask))
     {
-        VIV2D_UNSUPPORTED_MSG("Viv2DPrepareCopy unsupported alu src:%p/%p dst:%p/%p alu:%d",
-                pSrcPixmap, src, pDstPixmap, dst, alu);
+        VIV2D_UNSUPPORTED_MSG("Viv2DPrepareCopy unsupported alu src:%p/%p dst:%p/%p alu:%d planemask:%x",
+                pSrcPixmap, src, pDstPixmap, dst, alu, (uint32_t)planemask);
         return FALSE;
     }
+#endif
 
 #ifdef VIV2D_PREPARE_SET_FORMAT
     if (!_Viv2DSetFormat(pSrcPixmap->drawable.depth, pSrcPixmap->drawable.bitsPerPixel, &src->format))
@@ -1615,13 +2981,19 @@ static Bool Viv2DPrepareCopy (PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap,
         return FALSE;
     }
 #endif
-#ifndef VIV2D_SUPPORT_A8_DST
+#ifdef VIV2D_SUPPORT_MONO
+    if (dst->format.fmt == DE_FORMAT_MONOCHROME)
+        return FALSE;
+#endif
+#ifdef VIV2D_SUPPORT_A8_DST
+    if (dst->format.fmt == DE_FORMAT_A8 && !v2d->a8_target)
+#else
     if (dst->format.fmt == DE_FORMAT_A8)
+#endif
     {
         //		VIV2D_UNSUPPORTED_MSG("Viv2DPrepareCopy unsupported dst A8 dst:%p/%p", pDstPixmap, dst);
         return FALSE;
     }
-#endif
 
     dst->refcnt++;
 
@@ -1635,18 +3007,36 @@ static Bool Viv2DPrepareCopy (PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap,
     v2d->op.blend_op = NULL;
 #endif
 
+#ifdef VIV2D_ROP
+    if (alu != GXcopy || !EXA_PM_IS_SOLID(&pDstPixmap->drawable, planemask))
+    {
+        // blending would replace the rop
+        v2d->op.blend_op = NULL;
+        rop = viv2d_copy_rop[alu];
+    }
+    if (!EXA_PM_IS_SOLID(&pDstPixmap->drawable, planemask))
+    {
+        // planemask as the brush: rop where it is set, dst elsewhere
+        rop = (rop & 0xf0) | (ROP_DST & 0x0f);
+    }
+#endif
+
     if (v2d->op.blend_op)
     {
         _Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_ON_RES);
     }
     else
     {
-        _Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES);
+        _Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_SRC_BRUSH_FILL_RES);
     }
 
     _Viv2DStreamSrc(v2d, v2d->op.src);
-    _Viv2DStreamDst(v2d, v2d->op.dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+    _Viv2DStreamDst(v2d, v2d->op.dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, rop, NULL);
     _Viv2DStreamBlendOp(v2d, v2d->op.blend_op, FALSE, 0, FALSE, 0);
+#ifdef VIV2D_ROP
+    if (!EXA_PM_IS_SOLID(&pDstPixmap->drawable, planemask))
+        _Viv2DStreamBrushFill(v2d, Viv2DPixelColour(planemask, pDstPixmap->drawable.depth));
+#endif
 
     VIV2D_DBG_MSG("Viv2DPrepareCopy  src:%p/%p(%dx%d)[%s/%s] dst:%p/%p(%dx%d)[%s/%s] dir:%dx%d alu:%d planemask:%x",
             pSrcPixmap, src, src->width, src->height, Viv2DFormatColorStr(&src->format), Viv2DFormatSwizzleStr(&src->format),
@@ -1686,16 +3076,17 @@ static void Viv2DCopy (PixmapPtr pDstPixmap,
     Viv2DRec *v2d = Viv2DPrivFromPixmap(pDstPixmap);
 
     // new srcX,srcY group
-    if (v2d->op.prev_src_x != srcX || v2d->op.prev_src_y != srcY || v2d->op.cur_rect >= VIV2D_MAX_RECTS)
+    if (v2d->op.prev_src_x != srcX || v2d->op.prev_src_y != srcY || !_Viv2DOpGrowRects(&v2d->op))
     {
         // stream previous rects
         if (v2d->op.prev_src_x > -1)
         {
             // create states for srcX,srcY group
-            _Viv2DStreamReserve(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
-            _Viv2DStreamSrcOrigin(v2d, v2d->op.prev_src_x, v2d->op.prev_src_y, v2d->op.prev_width, v2d->op.prev_height);
-            _Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
-            _Viv2DStreamCacheFlush(v2d);
+            if (_Viv2DStreamReserveOp(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(v2d->op.cur_rect)))
+            {
+                _Viv2DStreamSrcOrigin(v2d, v2d->op.prev_src_x, v2d->op.prev_src_y, v2d->op.prev_width, v2d->op.prev_height);
+                _Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
+            }
 
             v2d->op.cur_rect = 0;
         }
@@ -1731,10 +3122,12 @@ static void Viv2DDoneCopy (PixmapPtr pDstPixmap)
 
     Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 
-    _Viv2DStreamReserve(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES);
-    _Viv2DStreamSrcOrigin(v2d, v2d->op.prev_src_x, v2d->op.prev_src_y, v2d->op.prev_width, v2d->op.prev_height);
-    _Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
-    _Viv2DStreamCacheFlush(v2d);
+    if (_Viv2DStreamReserveOp(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(v2d->op.cur_rect) + VIV2D_CACHE_FLUSH_RES))
+    {
+        _Viv2DStreamSrcOrigin(v2d, v2d->op.prev_src_x, v2d->op.prev_src_y, v2d->op.prev_width, v2d->op.prev_height);
+        _Viv2DStreamRects(v2d, v2d->op.rects, v2d->op.cur_rect);
+        _Viv2DStreamCacheFlush(v2d);
+    }
 
     VIV2D_DBG_MSG("Viv2DDoneCopy dst:%p/%p %d", pDstPixmap, v2d->op.dst, v2d->stream->offset);
 
@@ -1745,13 +3138,635 @@ static void Viv2DDoneCopy (PixmapPtr pDstPixmap)
     etna_bo_cpu_fini(v2d->op.dst->bo);
 #endif
 }
-/** @} */
-#else
-static Bool PrepareCopyFail(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir,
-        int alu, Pixel planemask)
+/** @} */
+#else
+static Bool PrepareCopyFail(PixmapPtr pSrc, PixmapPtr pDst, int xdir, int ydir,
+        int alu, Pixel planemask)
+{
+    return FALSE;
+}
+#endif
+
+#ifdef VIV2D_SUPPORT_MONO
+/** @name Mono
+ * @{
+ */
+/*
+ * EXA has no hook for 1bpp sources: core text with bitmap fonts, stippled
+ * fills and XYBitmap images all go to fb. The GC ops doing them are
+ * wrapped, the bitmap is repacked for the DE and expanded to the GC
+ * foreground and background colors by a mono BIT_BLT.
+ */
+#include "gcstruct.h"
+#include "dixfontstr.h"
+#include "dixfonts.h"
+#include "servermd.h"
+#include <byteswap.h>
+
+typedef struct _Viv2DMonoBitmap {
+	uint8_t *buf; // rows of bytes, leftmost pixel in the msb
+	int pitch;
+	int width;
+	int height;
+} Viv2DMonoBitmap;
+
+// draws the bitmap whose top left pixel is at x1, y1 in screen coordinates
+typedef void (*Viv2DMonoFillProc)(Viv2DMonoBitmap *bm, int x1, int y1, void *data);
+
+static inline uint8_t Viv2DBitReverse(uint8_t b)
+{
+	return ((b * 0x0802u & 0x22110u) | (b * 0x8020u & 0x88440u)) * 0x10101u >> 16;
+}
+
+static inline int Viv2DMod(int a, int b)
+{
+	a %= b;
+	return a < 0 ? a + b : a;
+}
+
+// or w x h pixels of a server order bitmap, starting sx pixels into its
+// rows, into bm at dx, dy. clipped to bm
+static void Viv2DMonoBlt(Viv2DMonoBitmap *bm, int dx, int dy,
+                         const uint8_t *bits, int stride, int sx, int w, int h)
+{
+	if (dx < 0) {
+		sx -= dx;
+		w += dx;
+		dx = 0;
+	}
+	if (dy < 0) {
+		bits -= dy * stride;
+		h += dy;
+		dy = 0;
+	}
+	if (dx + w > bm->width)
+		w = bm->width - dx;
+	if (dy + h > bm->height)
+		h = bm->height - dy;
+	if (w <= 0 || h <= 0)
+		return;
+
+	for (int y = 0; y < h; y++) {
+		const uint8_t *s = bits + y * stride;
+		uint8_t *d = bm->buf + (dy + y) * bm->pitch;
+		int last = (sx + w - 1) >> 3;
+
+		for (int i = 0; i < w; i += 8) {
+			int k = (sx + i) >> 3;
+			int shift = (sx + i) & 7;
+			int x = dx + i;
+			uint32_t v;
+			uint8_t b, spill;
+
+#if BITMAP_BIT_ORDER == LSBFirst
+			v = s[k];
+			if (shift && k < last)
+				v |= s[k + 1] << 8;
+			b = Viv2DBitReverse(v >> shift);
+#else
+			v = s[k] << 8;
+			if (shift && k < last)
+				v |= s[k + 1];
+			b = v >> (8 - shift);
+#endif
+			if (w - i < 8)
+				b &= 0xff << (8 - (w - i));
+
+			d[x >> 3] |= b >> (x & 7);
+			// only set bits spill over, and those are inside the row
+			spill = b << (8 - (x & 7));
+			if ((x & 7) && spill)
+				d[(x >> 3) + 1] |= spill;
+		}
+	}
+}
+
+// destination of a mono expansion into pDrawable, NULL when it goes to fb
+static Viv2DPixmapPrivPtr Viv2DMonoDst(DrawablePtr pDrawable, GCPtr pGC, int alu)
+{
+	Viv2DRec *v2d = Viv2DPrivFromScreen(pDrawable->pScreen);
+	PixmapPtr pPixmap = GetDrawablePixmap(pDrawable);
+	struct ARMSOCPixmapPrivRec *armsocPix = exaGetPixmapDriverPrivate(pPixmap);
+	Viv2DPixmapPrivPtr dst;
+
+	if (!armsocPix || !armsocPix->priv)
+		return NULL;
+
+	dst = armsocPix->priv;
+	// no bo, or in cpu access
+	if (!dst->bo || dst->refcnt < 0)
+		return NULL;
+
+#ifndef VIV2D_ROP
+	if (alu != GXcopy)
+		return NULL;
+#endif
+	if (!EXA_PM_IS_SOLID(pDrawable, pGC->planemask))
+		return NULL;
+
+	if (!_Viv2DSetFormat(pPixmap->drawable.depth, pPixmap->drawable.bitsPerPixel, &dst->format) ||
+	        dst->format.fmt == DE_FORMAT_MONOCHROME)
+		return NULL;
+#ifdef VIV2D_SUPPORT_A8_DST
+	if (dst->format.fmt == DE_FORMAT_A8 && !v2d->a8_target)
+#else
+	if (dst->format.fmt == DE_FORMAT_A8)
+#endif
+		return NULL;
+
+	return dst;
+}
+
+// room for size bytes of bitmap in the mono scratch bo, packed after the
+// previous ones. once full it is reused from its start if the gpu is done,
+// else the bitmap gets a bo of its own, *bo is not the scratch bo then
+static Bool Viv2DMonoStage(Viv2DRec *v2d, uint32_t size, struct etna_bo **bo, uint32_t *offset)
+{
+	uint32_t start = ALIGN(v2d->mono_used, VIV2D_MONO_ALIGN);
+
+	if (!v2d->mono_bo) {
+		v2d->mono_bo = etna_bo_new(v2d->dev, VIV2D_MONO_MAX_SIZE, ETNA_BO_WC);
+		if (!v2d->mono_bo)
+			return FALSE;
+		start = 0;
+	} else if (start + size > VIV2D_MONO_MAX_SIZE) {
+		if (!etna_bo_idle(v2d->mono_bo, ETNA_PREP_WRITE)) {
+			*bo = etna_bo_cache_new(v2d->dev, size, ETNA_BO_WC);
+			*offset = 0;
+			return *bo != NULL;
+		}
+		start = 0;
+	}
+
+	v2d->mono_used = start + size;
+	*bo = v2d->mono_bo;
+	*offset = start;
+	return TRUE;
+}
+
+static void Viv2DMonoFini(Viv2DRec *v2d)
+{
+	if (v2d->mono_bo)
+		etna_bo_del(v2d->mono_bo);
+	free(v2d->mono_buf);
+}
+
+/*
+ * Expand the bitmap fill() draws over area, in screen coordinates, into
+ * pDrawable through the GC composite clip: 1 bits with the fg color and
+ * the alu, 0 bits with the bg color and the alu when opaque, left
+ * untouched otherwise. FALSE if the bitmap could not be staged, nothing
+ * is drawn then.
+ */
+static Bool Viv2DMonoExpand(DrawablePtr pDrawable, GCPtr pGC, Viv2DPixmapPrivPtr dst,
+                            Viv2DRect *area, int alu, Bool opaque, Viv2DMonoFillProc fill, void *data)
+{
+	ScreenPtr pScreen = pDrawable->pScreen;
+	Viv2DRec *v2d = Viv2DPrivFromScreen(pScreen);
+	PixmapPtr pPixmap = GetDrawablePixmap(pDrawable);
+	RegionPtr clip = pGC->pCompositeClip;
+	BoxPtr cbox = RegionRects(clip);
+	int nbox = RegionNumRects(clip);
+	int xoff = 0, yoff = 0;
+	Viv2DMonoBitmap bm;
+	Viv2DPixmapPrivRec tmp = { 0 };
+	Viv2DRect box, rect;
+	uint32_t *src, *map;
+	uint32_t fg, bg;
+	int rop_fg, rop_bg;
+	Bool drawn = FALSE;
+
+	// nothing outside of the clip is drawn, do not stage it
+	box.x1 = max(area->x1, clip->extents.x1);
+	box.y1 = max(area->y1, clip->extents.y1);
+	box.x2 = min(area->x2, clip->extents.x2);
+	box.y2 = min(area->y2, clip->extents.y2);
+	if (box.x1 >= box.x2 || box.y1 >= box.y2)
+		return TRUE;
+
+	bm.width = box.x2 - box.x1;
+	bm.height = box.y2 - box.y1;
+	bm.pitch = ALIGN((bm.width + 7) / 8, VIV2D_PITCH_ALIGN);
+	if (bm.pitch * bm.height > VIV2D_MONO_MAX_SIZE)
+		return FALSE;
+
+	// built in cached memory, glyphs and stipples are or-ed into it
+	if (!v2d->mono_buf) {
+		v2d->mono_buf = malloc(VIV2D_MONO_MAX_SIZE);
+		if (!v2d->mono_buf)
+			return FALSE;
+	}
+	bm.buf = v2d->mono_buf;
+	memset(bm.buf, 0, bm.pitch * bm.height);
+
+	if (!Viv2DMonoStage(v2d, bm.pitch * bm.height, &tmp.bo, &tmp.offset))
+		return FALSE;
+
+	fill(&bm, box.x1, box.y1, data);
+
+	tmp.width = bm.width;
+	tmp.height = bm.height;
+	tmp.pitch = bm.pitch;
+	_Viv2DSetFormat(1, 1, &tmp.format);
+
+	// the DE reads little endian words, the leftmost byte of each has to
+	// be its most significant one. the pitch is a multiple of 4 bytes
+	src = (uint32_t *) bm.buf;
+	map = (uint32_t *) ((uint8_t *) etna_bo_map(tmp.bo) + tmp.offset);
+	for (int i = 0; i < bm.pitch * bm.height / 4; i++)
+		map[i] = bswap_32(src[i]);
+
+#ifdef COMPOSITE
+	if (pDrawable->type == DRAWABLE_WINDOW) {
+		xoff = -pPixmap->screen_x;
+		yoff = -pPixmap->screen_y;
+	}
+#endif
+
+#ifdef VIV2D_ROP
+	rop_fg = viv2d_copy_rop[alu];
+#else
+	rop_fg = ROP_SRC;
+#endif
+	rop_bg = opaque ? rop_fg : ROP_DST;
+	fg = Viv2DPixelColour(pGC->fgPixel, pDrawable->depth);
+	bg = Viv2DPixelColour(pGC->bgPixel, pDrawable->depth);
+
+	rect.x1 = box.x1 + xoff;
+	rect.y1 = box.y1 + yoff;
+	rect.x2 = box.x2 + xoff;
+	rect.y2 = box.y2 + yoff;
+
+	dst->refcnt++;
+
+	// the DE clip cuts the blit to each clip box, the source stays in place
+	for (int i = 0; i < nbox && cbox[i].y1 < box.y2; i++) {
+		Viv2DRect clip_rect;
+
+		clip_rect.x1 = max(cbox[i].x1, box.x1) + xoff;
+		clip_rect.y1 = max(cbox[i].y1, box.y1) + yoff;
+		clip_rect.x2 = min(cbox[i].x2, box.x2) + xoff;
+		clip_rect.y2 = min(cbox[i].y2, box.y2) + yoff;
+		if (clip_rect.x1 >= clip_rect.x2 || clip_rect.y1 >= clip_rect.y2)
+			continue;
+
+		_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_SRC_MONO_RES + VIV2D_DEST_RES +
+		                    VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
+		_Viv2DStreamSrc(v2d, &tmp);
+		_Viv2DStreamSrcOrigin(v2d, 0, 0, tmp.width, tmp.height);
+		_Viv2DStreamMonoColor(v2d, fg, bg);
+		_Viv2DStreamDstRop4(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, rop_fg, rop_bg, &clip_rect);
+		_Viv2DStreamBlendOp(v2d, NULL, 0, 0, FALSE, FALSE);
+		_Viv2DStreamRects(v2d, &rect, 1);
+		drawn = TRUE;
+	}
+
+	// the last reserve made room for it
+	if (drawn)
+		_Viv2DStreamCacheFlush(v2d);
+
+	if (tmp.bo != v2d->mono_bo)
+		etna_bo_cache_del(v2d->dev, tmp.bo);
+
+	VIV2D_DBG_MSG("Viv2DMonoExpand dst:%p %dx%d:%dx%d opaque:%d alu:%d fg:%08x bg:%08x",
+	              dst, rect.x1, rect.y1, rect.x2, rect.y2, opaque, alu, fg, bg);
+
+	exaMarkSync(pScreen);
+
+	return TRUE;
+}
+
+typedef struct _Viv2DMonoGlyphs {
+	int x; // origin of the text, screen coordinates
+	int y;
+	unsigned int nglyph;
+	CharInfoPtr *ppci;
+	void *pglyphBase;
+} Viv2DMonoGlyphs;
+
+static void Viv2DMonoFillGlyphs(Viv2DMonoBitmap *bm, int x1, int y1, void *data)
+{
+	Viv2DMonoGlyphs *g = data;
+	int x = g->x - x1;
+
+	for (unsigned int i = 0; i < g->nglyph; i++) {
+		CharInfoPtr pci = g->ppci[i];
+
+		Viv2DMonoBlt(bm, x + pci->metrics.leftSideBearing, g->y - y1 - pci->metrics.ascent,
+		             FONTGLYPHBITS(g->pglyphBase, pci), GLYPHWIDTHBYTESPADDED(pci), 0,
+		             GLYPHWIDTHPIXELS(pci), GLYPHHEIGHTPIXELS(pci));
+		x += pci->metrics.characterWidth;
+	}
+}
+
+typedef struct _Viv2DMonoImage {
+	const uint8_t *bits;
+	int stride;
+	int left_pad;
+	Viv2DRect box; // screen coordinates
+} Viv2DMonoImage;
+
+static void Viv2DMonoFillImage(Viv2DMonoBitmap *bm, int x1, int y1, void *data)
+{
+	Viv2DMonoImage *img = data;
+
+	Viv2DMonoBlt(bm, img->box.x1 - x1, img->box.y1 - y1, img->bits, img->stride, img->left_pad,
+	             img->box.x2 - img->box.x1, img->box.y2 - img->box.y1);
+}
+
+typedef struct _Viv2DMonoStipple {
+	const uint8_t *bits;
+	int stride;
+	int width;
+	int height;
+	int x; // stipple origin, screen coordinates
+	int y;
+} Viv2DMonoStipple;
+
+static void Viv2DMonoFillStipple(Viv2DMonoBitmap *bm, int x1, int y1, void *data)
+{
+	Viv2DMonoStipple *st = data;
+	int sx = Viv2DMod(x1 - st->x, st->width);
+	int sy = Viv2DMod(y1 - st->y, st->height);
+
+	for (int y = 0; y < bm->height; y++) {
+		const uint8_t *row;
+
+		// rows repeat every stipple height
+		if (y >= st->height) {
+			memcpy(bm->buf + y * bm->pitch, bm->buf + (y - st->height) * bm->pitch, bm->pitch);
+			continue;
+		}
+
+		row = st->bits + ((sy + y) % st->height) * st->stride;
+		for (int x = 0, s = sx; x < bm->width; x += st->width - s, s = 0)
+			Viv2DMonoBlt(bm, x, y, row, st->stride, s, st->width - s, 1);
+	}
+}
+
+/* GC wrapping, the mono ops are swapped into a copy of the wrapped ops */
+
+static DevPrivateKeyRec viv2d_gc_key;
+
+typedef struct _Viv2DGCPriv {
+	const GCFuncs *funcs; // wrapped
+	const GCOps *ops; // wrapped
+	GCOps mono_ops;
+} Viv2DGCPrivRec, *Viv2DGCPrivPtr;
+
+static const GCFuncs viv2d_gc_funcs;
+
+static inline Viv2DGCPrivPtr Viv2DGCPriv(GCPtr pGC)
+{
+	return dixLookupPrivate(&pGC->devPrivates, &viv2d_gc_key);
+}
+
+static void Viv2DPutImage(DrawablePtr pDrawable, GCPtr pGC, int depth, int x, int y,
+                          int w, int h, int leftPad, int format, char *pBits);
+static void Viv2DPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect, xRectangle *prect);
+static void Viv2DImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                               unsigned int nglyph, CharInfoPtr *ppci, void *pglyphBase);
+static void Viv2DPolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                              unsigned int nglyph, CharInfoPtr *ppci, void *pglyphBase);
+
+static void Viv2DGCWrap(GCPtr pGC, Viv2DGCPrivPtr priv)
+{
+	if (priv->ops != pGC->ops) {
+		priv->ops = pGC->ops;
+		priv->mono_ops = *pGC->ops;
+		priv->mono_ops.PutImage = Viv2DPutImage;
+		priv->mono_ops.PolyFillRect = Viv2DPolyFillRect;
+		priv->mono_ops.ImageGlyphBlt = Viv2DImageGlyphBlt;
+		priv->mono_ops.PolyGlyphBlt = Viv2DPolyGlyphBlt;
+	}
+	priv->funcs = pGC->funcs;
+	pGC->funcs = &viv2d_gc_funcs;
+	pGC->ops = &priv->mono_ops;
+}
+
+static inline void Viv2DGCUnwrap(GCPtr pGC, Viv2DGCPrivPtr priv)
+{
+	pGC->funcs = priv->funcs;
+	pGC->ops = priv->ops;
+}
+
+// call into the wrapped funcs and ops
+#define VIV2D_GC_UNWRAPPED(pGC, call) do { \
+	Viv2DGCPrivPtr _priv = Viv2DGCPriv(pGC); \
+	Viv2DGCUnwrap(pGC, _priv); \
+	call; \
+	Viv2DGCWrap(pGC, _priv); \
+} while (0)
+
+static void Viv2DValidateGC(GCPtr pGC, unsigned long changes, DrawablePtr pDrawable)
+{
+	VIV2D_GC_UNWRAPPED(pGC, pGC->funcs->ValidateGC(pGC, changes, pDrawable));
+}
+
+static void Viv2DChangeGC(GCPtr pGC, unsigned long mask)
+{
+	VIV2D_GC_UNWRAPPED(pGC, pGC->funcs->ChangeGC(pGC, mask));
+}
+
+static void Viv2DCopyGC(GCPtr pGCSrc, unsigned long mask, GCPtr pGCDst)
+{
+	VIV2D_GC_UNWRAPPED(pGCDst, pGCDst->funcs->CopyGC(pGCSrc, mask, pGCDst));
+}
+
+static void Viv2DDestroyGC(GCPtr pGC)
+{
+	VIV2D_GC_UNWRAPPED(pGC, pGC->funcs->DestroyGC(pGC));
+}
+
+static void Viv2DChangeClip(GCPtr pGC, int type, void *pvalue, int nrects)
+{
+	VIV2D_GC_UNWRAPPED(pGC, pGC->funcs->ChangeClip(pGC, type, pvalue, nrects));
+}
+
+static void Viv2DDestroyClip(GCPtr pGC)
+{
+	VIV2D_GC_UNWRAPPED(pGC, pGC->funcs->DestroyClip(pGC));
+}
+
+static void Viv2DCopyClip(GCPtr pGCDst, GCPtr pGCSrc)
+{
+	VIV2D_GC_UNWRAPPED(pGCDst, pGCDst->funcs->CopyClip(pGCDst, pGCSrc));
+}
+
+static const GCFuncs viv2d_gc_funcs = {
+	Viv2DValidateGC,
+	Viv2DChangeGC,
+	Viv2DCopyGC,
+	Viv2DDestroyGC,
+	Viv2DChangeClip,
+	Viv2DDestroyClip,
+	Viv2DCopyClip,
+};
+
+static Bool Viv2DCreateGC(GCPtr pGC)
+{
+	ScreenPtr pScreen = pGC->pScreen;
+	Viv2DRec *v2d = Viv2DPrivFromScreen(pScreen);
+	Bool ret;
+
+	pScreen->CreateGC = v2d->CreateGC;
+	ret = pScreen->CreateGC(pGC);
+	pScreen->CreateGC = Viv2DCreateGC;
+
+	if (ret)
+		Viv2DGCWrap(pGC, Viv2DGCPriv(pGC));
+
+	return ret;
+}
+
+static void Viv2DPutImage(DrawablePtr pDrawable, GCPtr pGC, int depth, int x, int y,
+                          int w, int h, int leftPad, int format, char *pBits)
+{
+	Viv2DPixmapPrivPtr dst;
+
+	// XYBitmap is fg where 1, bg where 0, whatever the fill style
+	if (format == XYBitmap && (dst = Viv2DMonoDst(pDrawable, pGC, pGC->alu))) {
+		Viv2DMonoImage img;
+
+		img.bits = (const uint8_t *)pBits;
+		img.stride = BitmapBytePad(w + leftPad);
+		img.left_pad = leftPad;
+		img.box.x1 = pDrawable->x + x;
+		img.box.y1 = pDrawable->y + y;
+		img.box.x2 = img.box.x1 + w;
+		img.box.y2 = img.box.y1 + h;
+
+		if (Viv2DMonoExpand(pDrawable, pGC, dst, &img.box, pGC->alu, TRUE, Viv2DMonoFillImage, &img))
+			return;
+	}
+
+	VIV2D_GC_UNWRAPPED(pGC, pGC->ops->PutImage(pDrawable, pGC, depth, x, y, w, h, leftPad, format, pBits));
+}
+
+// cpu view of the stipple, which the gpu never renders to
+static Bool Viv2DMonoPrepareStipple(PixmapPtr pStipple)
+{
+	if (!exaGetPixmapDriverPrivate(pStipple) || pStipple->devPrivate.ptr)
+		return FALSE;
+#ifdef VIV2D_ACCESS
+	return Viv2DPrepareAccess(pStipple, EXA_PREPARE_SRC);
+#else
+	return ARMSOCPrepareAccess(pStipple, EXA_PREPARE_SRC);
+#endif
+}
+
+static void Viv2DMonoFinishStipple(PixmapPtr pStipple)
+{
+#ifdef VIV2D_ACCESS
+	Viv2DFinishAccess(pStipple, EXA_PREPARE_SRC);
+#else
+	ARMSOCFinishAccess(pStipple, EXA_PREPARE_SRC);
+#endif
+}
+
+static void Viv2DPolyFillRect(DrawablePtr pDrawable, GCPtr pGC, int nrect, xRectangle *prect)
+{
+	PixmapPtr pStipple = pGC->stipple;
+	Viv2DPixmapPrivPtr dst;
+	int i = 0;
+
+	if ((pGC->fillStyle == FillStippled || pGC->fillStyle == FillOpaqueStippled) &&
+	        pStipple && (dst = Viv2DMonoDst(pDrawable, pGC, pGC->alu)) &&
+	        Viv2DMonoPrepareStipple(pStipple)) {
+		Viv2DMonoStipple st;
+
+		st.bits = pStipple->devPrivate.ptr;
+		st.stride = pStipple->devKind;
+		st.width = pStipple->drawable.width;
+		st.height = pStipple->drawable.height;
+		st.x = pDrawable->x + pGC->patOrg.x;
+		st.y = pDrawable->y + pGC->patOrg.y;
+
+		for (; i < nrect; i++) {
+			Viv2DRect box;
+
+			box.x1 = pDrawable->x + prect[i].x;
+			box.y1 = pDrawable->y + prect[i].y;
+			box.x2 = box.x1 + prect[i].width;
+			box.y2 = box.y1 + prect[i].height;
+
+			if (!Viv2DMonoExpand(pDrawable, pGC, dst, &box, pGC->alu,
+			                     pGC->fillStyle == FillOpaqueStippled, Viv2DMonoFillStipple, &st))
+				break;
+		}
+
+		Viv2DMonoFinishStipple(pStipple);
+
+		if (i == nrect)
+			return;
+	}
+
+	// fb does what is left
+	VIV2D_GC_UNWRAPPED(pGC, pGC->ops->PolyFillRect(pDrawable, pGC, nrect - i, prect + i));
+}
+
+static void Viv2DMonoGlyphExtents(GCPtr pGC, Viv2DMonoGlyphs *g, Viv2DRect *ink, Viv2DRect *back)
+{
+	ExtentInfoRec extents;
+
+	QueryGlyphExtents(pGC->font, g->ppci, g->nglyph, &extents);
+
+	ink->x1 = g->x + extents.overallLeft;
+	ink->y1 = g->y - extents.overallAscent;
+	ink->x2 = g->x + extents.overallRight;
+	ink->y2 = g->y + extents.overallDescent;
+
+	if (!back)
+		return;
+
+	back->x1 = g->x + min(extents.overallWidth, 0);
+	back->y1 = g->y - extents.fontAscent;
+	back->x2 = g->x + max(extents.overallWidth, 0);
+	back->y2 = g->y + extents.fontDescent;
+}
+
+static void Viv2DPolyGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                              unsigned int nglyph, CharInfoPtr *ppci, void *pglyphBase)
+{
+	Viv2DPixmapPrivPtr dst;
+
+	if (pGC->fillStyle == FillSolid && (dst = Viv2DMonoDst(pDrawable, pGC, pGC->alu))) {
+		Viv2DMonoGlyphs g = { pDrawable->x + x, pDrawable->y + y, nglyph, ppci, pglyphBase };
+		Viv2DRect ink;
+
+		Viv2DMonoGlyphExtents(pGC, &g, &ink, NULL);
+		if (Viv2DMonoExpand(pDrawable, pGC, dst, &ink, pGC->alu, FALSE, Viv2DMonoFillGlyphs, &g))
+			return;
+	}
+
+	VIV2D_GC_UNWRAPPED(pGC, pGC->ops->PolyGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci, pglyphBase));
+}
+
+// image text ignores the alu and the fill style
+static void Viv2DImageGlyphBlt(DrawablePtr pDrawable, GCPtr pGC, int x, int y,
+                               unsigned int nglyph, CharInfoPtr *ppci, void *pglyphBase)
 {
-    return FALSE;
+	Viv2DPixmapPrivPtr dst;
+
+	if ((dst = Viv2DMonoDst(pDrawable, pGC, GXcopy))) {
+		Viv2DMonoGlyphs g = { pDrawable->x + x, pDrawable->y + y, nglyph, ppci, pglyphBase };
+		Viv2DRect ink, back;
+
+		Viv2DMonoGlyphExtents(pGC, &g, &ink, &back);
+
+		// opaque over the background box, then the ink sticking out of it
+		if (Viv2DMonoExpand(pDrawable, pGC, dst, &back, GXcopy, TRUE, Viv2DMonoFillGlyphs, &g)) {
+			if (ink.x1 >= ink.x2 || ink.y1 >= ink.y2 ||
+			        (ink.x1 >= back.x1 && ink.y1 >= back.y1 && ink.x2 <= back.x2 && ink.y2 <= back.y2))
+				return;
+			if (Viv2DMonoExpand(pDrawable, pGC, dst, &ink, GXcopy, FALSE, Viv2DMonoFillGlyphs, &g))
+				return;
+		}
+	}
+
+	VIV2D_GC_UNWRAPPED(pGC, pGC->ops->ImageGlyphBlt(pDrawable, pGC, x, y, nglyph, ppci, pglyphBase));
 }
+/** @} */
 #endif
 
 #ifdef VIV2D_COMPOSITE
@@ -1779,6 +3794,67 @@ static Bool Viv2DGetPictureFormat(int exa_fmt, Viv2DFormat * fmt)
     return isFound;
 }
 
+#ifdef VIV2D_SCALE_TRANSFORM
+// transform is a positive scale plus a translation, nothing else
+static Bool Viv2DIsScaleTransform(PictTransformPtr t)
+{
+	return t->matrix[0][1] == 0 && t->matrix[1][0] == 0 &&
+	       t->matrix[2][0] == 0 && t->matrix[2][1] == 0 &&
+	       t->matrix[2][2] == xFixed1 &&
+	       t->matrix[0][0] > 0 && t->matrix[1][1] > 0;
+}
+
+// size of the source once scaled to destination space
+static inline int Viv2DScaledSize(int size, xFixed scale)
+{
+	return (int)(((int64_t)size << 16) / scale);
+}
+
+// round(a / b) for b > 0
+static inline int Viv2DFixedDivRound(xFixed a, xFixed b)
+{
+	int64_t n = 2 * (int64_t)a + b;
+	int64_t d = 2 * (int64_t)b;
+
+	return (int)(n >= 0 ? n / d : -((-n + d - 1) / d));
+}
+
+// ops leaving dst untouched where the source is transparent: the parts
+// of the dst outside the scaled source can simply be skipped
+static Bool Viv2DTransparentSrcIsNoop(int op)
+{
+	switch (op) {
+	case PictOpDst:
+	case PictOpOver:
+	case PictOpOutReverse:
+	case PictOpAtop:
+	case PictOpXor:
+	case PictOpAdd:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+#endif
+
+static Bool Viv2DFilterSupported(int filter)
+{
+	switch (filter) {
+	case PictFilterNearest:
+		return TRUE;
+#ifdef VIV2D_SCALE_TRANSFORM
+	case PictFilterBilinear:
+	case PictFilterFast:
+	case PictFilterGood:
+	case PictFilterBest:
+		// exact without a transform, scaled by the DE otherwise
+		return TRUE;
+#endif
+	default:
+		return FALSE;
+	}
+}
+
 /**
  * CheckComposite() checks to see if a composite operation could be accelerated.
  *
@@ -1845,13 +3921,15 @@ static Bool Viv2DCheckComposite (int op,
         return FALSE;
     }
 
-#ifndef VIV2D_SUPPORT_A8_DST
+#ifdef VIV2D_SUPPORT_A8_DST
+    if (dst_fmt.fmt == DE_FORMAT_A8 && !Viv2DPrivFromPixmap(pDst)->a8_target)
+#else
     if (dst_fmt.fmt == DE_FORMAT_A8)
+#endif
     {
         //		VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite unsupported dst A8 dst:%p", pDst);
         return FALSE;
     }
-#endif
 
     /*For forward compatibility*/
     if (op > BLEND_SIZE)
@@ -1884,10 +3962,40 @@ static Bool Viv2DCheckComposite (int op,
 
     if ( pSrcPicture->transform )
     {
+#ifdef VIV2D_SCALE_TRANSFORM
+        PictTransformPtr t = pSrcPicture->transform;
+
+        if (!pSrc || pSrcPicture->repeat || !Viv2DIsScaleTransform(t))
+        {
+            VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite src transform unsupported %d", pSrcPicture->transform);
+            return FALSE;
+        }
+        if (!Viv2DTransparentSrcIsNoop(op))
+        {
+            VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite src transform unsupported op:%s", pix_op_name(op));
+            return FALSE;
+        }
+        // the scaled copy is a destination, A8 is not
+        if (src_fmt.fmt == DE_FORMAT_A8 &&
+            (t->matrix[0][0] != xFixed1 || t->matrix[1][1] != xFixed1))
+        {
+            VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite src transform unsupported A8 scale");
+            return FALSE;
+        }
+        if (Viv2DScaledSize(pSrc->drawable.width, t->matrix[0][0]) < 1 ||
+            Viv2DScaledSize(pSrc->drawable.width, t->matrix[0][0]) > VIV2D_SCALE_MAX_SIZE ||
+            Viv2DScaledSize(pSrc->drawable.height, t->matrix[1][1]) < 1 ||
+            Viv2DScaledSize(pSrc->drawable.height, t->matrix[1][1]) > VIV2D_SCALE_MAX_SIZE)
+        {
+            VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite src transform scaled size unsupported");
+            return FALSE;
+        }
+#else
         VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite src transform unsupported %d", pSrcPicture->transform);
         return FALSE;
+#endif
     }
-    if (pSrcPicture->filter)
+    if (!Viv2DFilterSupported(pSrcPicture->filter))
     {
         VIV2D_UNSUPPORTED_MSG("Viv2DPrepareComposite unsupported src filter %d", pSrcPicture->filter);
         return FALSE;
@@ -1916,7 +4024,7 @@ static Bool Viv2DCheckComposite (int op,
             return FALSE;
         }
 
-        if (pMaskPicture->filter) {
+        if (!Viv2DFilterSupported(pMaskPicture->filter)) {
             VIV2D_UNSUPPORTED_MSG("Viv2DPrepareComposite unsupported msk filter %d", pMaskPicture->filter);
             return FALSE;
         }
@@ -1939,6 +4047,10 @@ static Bool Viv2DCheckComposite (int op,
         {
             if (pMask->drawable.width == 1 && pMask->drawable.height == 1) {
                 // 1x1 stretch
+#ifdef VIV2D_REPEAT_TILE
+            } else if (pMaskPicture->repeatType == RepeatNormal) {
+                // split at the tile edges
+#endif
             } else {
                 VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite mask repeat > 1x1 unsupported");
                 return FALSE;
@@ -1957,6 +4069,10 @@ static Bool Viv2DCheckComposite (int op,
 
         if (pSrc->drawable.width == 1 && pSrc->drawable.height == 1) {
             // 1x1 stretch
+#ifdef VIV2D_REPEAT_TILE
+        } else if (pSrcPicture->repeatType == RepeatNormal) {
+            // split at the tile edges
+#endif
         } else {
             VIV2D_UNSUPPORTED_MSG("Viv2DCheckComposite repeat > 1x1 unsupported");
             return FALSE;
@@ -2031,6 +4147,111 @@ static Bool Viv2DCheckComposite (int op,
  * of cairo applications.  Failure results in a fallback to software
  * rendering.
  */
+#ifdef VIV2D_REPEAT_TILE
+// a small tile would split the op into many tiny rects: repeat it into a
+// scratch of at least VIV2D_TILE_MIN_SIZE first, with a single DRAW_2D
+static void Viv2DOpExpandTile(Viv2DRec *v2d)
+{
+	Viv2DOp *op = &v2d->op;
+	int tw = op->src_tile_w;
+	int th = op->src_tile_h;
+	int nx = tw < VIV2D_TILE_MIN_SIZE ? (VIV2D_TILE_MIN_SIZE + tw - 1) / tw : 1;
+	int ny = th < VIV2D_TILE_MIN_SIZE ? (VIV2D_TILE_MIN_SIZE + th - 1) / th : 1;
+	Viv2DPixmapPrivPtr tile;
+
+	// A8 is not a destination format
+	if (nx * ny == 1 || op->src_fmt.fmt == DE_FORMAT_A8)
+		return;
+
+	tile = _Viv2DOpCreateTmpPix(v2d, tw * nx, th * ny, op->src_fmt.bpp);
+	tile->format = op->src_fmt;
+
+	_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES);
+	_Viv2DStreamSrcWithFormat(v2d, op->src, &op->src_fmt);
+	_Viv2DStreamSrcOrigin(v2d, 0, 0, tw, th);
+	_Viv2DStreamDst(v2d, tile, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, ROP_SRC, NULL);
+	_Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0);
+
+	// every copy reads the tile from its origin
+	op->cur_rect = 0;
+	for (int j = 0; j < ny; j++) {
+		for (int i = 0; i < nx; i++) {
+			if (!_Viv2DOpGrowRects(op)) {
+				if (_Viv2DStreamReserveOp(v2d, VIV2D_RECTS_RES(op->cur_rect)))
+					_Viv2DStreamRects(v2d, op->rects, op->cur_rect);
+				op->cur_rect = 0;
+			}
+			_Viv2DOpAddRect(op, i * tw, j * th, tw, th);
+		}
+	}
+	if (_Viv2DStreamReserveOp(v2d, VIV2D_RECTS_RES(op->cur_rect) + VIV2D_CACHE_FLUSH_RES)) {
+		_Viv2DStreamRects(v2d, op->rects, op->cur_rect);
+		_Viv2DStreamCacheFlush(v2d);
+	}
+	op->cur_rect = 0;
+
+	VIV2D_DBG_MSG("Viv2DOpExpandTile %dx%d -> %dx%d", tw, th, tw * nx, th * ny);
+
+	op->tile = tile;
+	op->src = tile;
+	op->src_tile_w = tw * nx;
+	op->src_tile_h = th * ny;
+}
+#endif
+
+#ifdef VIV2D_SCALE_TRANSFORM
+static void Viv2DFilterScale(Viv2DRec *v2d, Viv2DPixmapPrivPtr src, Viv2DPixmapPrivPtr dst);
+
+// scale + translation: scale the whole src once into a scratch in dst
+// space, the op then reads it untransformed at the translation
+static void Viv2DOpScaleSource(Viv2DRec *v2d, PicturePtr pSrcPicture)
+{
+	Viv2DOp *op = &v2d->op;
+	PictTransformPtr t = pSrcPicture->transform;
+	xFixed sx = t->matrix[0][0];
+	xFixed sy = t->matrix[1][1];
+	Viv2DPixmapPrivPtr src = op->src;
+	Viv2DPixmapPrivPtr scaled;
+
+	op->src_transform = TRUE;
+	op->src_off_x = Viv2DFixedDivRound(t->matrix[0][2], sx);
+	op->src_off_y = Viv2DFixedDivRound(t->matrix[1][2], sy);
+
+	// translation only
+	if (sx == xFixed1 && sy == xFixed1)
+		return;
+
+	scaled = _Viv2DOpCreateTmpPix(v2d, Viv2DScaledSize(src->width, sx),
+	                              Viv2DScaledSize(src->height, sy), op->src_fmt.bpp);
+	scaled->format = op->src_fmt;
+
+	if ((pSrcPicture->filter == PictFilterGood || pSrcPicture->filter == PictFilterBest) &&
+	        src->width > 1 && src->height > 1 && scaled->width > 1 && scaled->height > 1) {
+		// lanczos, as Xv
+		Viv2DFilterScale(v2d, src, scaled);
+	} else {
+		_Viv2DStreamReserve(v2d, VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_SRC_STRETCH_RES + VIV2D_DEST_RES +
+		                    VIV2D_BLEND_OFF_RES + VIV2D_RECTS_RES(1) + VIV2D_CACHE_FLUSH_RES);
+		_Viv2DStreamSrcWithFormat(v2d, src, &op->src_fmt);
+		_Viv2DStreamSrcOrigin(v2d, 0, 0, src->width, src->height);
+		_Viv2DStreamStretch(v2d, src, scaled);
+		_Viv2DStreamDst(v2d, scaled, VIVS_DE_DEST_CONFIG_COMMAND_STRETCH_BLT, ROP_SRC, NULL);
+		_Viv2DStreamBlendOp(v2d, NULL, FALSE, 0, FALSE, 0);
+
+		_Viv2DOpAddRect(op, 0, 0, scaled->width, scaled->height);
+		_Viv2DStreamRects(v2d, op->rects, op->cur_rect);
+		_Viv2DStreamCacheFlush(v2d);
+		op->cur_rect = 0;
+	}
+
+	VIV2D_DBG_MSG("Viv2DOpScaleSource %dx%d -> %dx%d off:%dx%d filter:%d", src->width, src->height,
+	              scaled->width, scaled->height, op->src_off_x, op->src_off_y, pSrcPicture->filter);
+
+	op->scaled = scaled;
+	op->src = scaled;
+}
+#endif
+
 static Bool Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
                       PicturePtr pMaskPicture,
                       PicturePtr pDstPicture,
@@ -2051,6 +4272,13 @@ static Bool Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 		src = Viv2DPixmapPrivFromPixmap(pSrc);
 	}
 
+#ifdef VIV2D_PLACEMENT
+	if (pSrc != NULL)
+		Viv2DPixmapToGpu(v2d, pSrc);
+	if (pMask != NULL)
+		Viv2DPixmapToGpu(v2d, pMask);
+	Viv2DPixmapToGpu(v2d, pDst);
+#endif
 	if ((src && !src->bo) || !dst->bo) {
 		// CPU only
 		return FALSE;
@@ -2118,7 +4346,7 @@ static Bool Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 #ifdef VIV2D_1X1_REPEAT_AS_SOLID
 // armada way
 		v2d->op.src_type = viv2d_src_clear;
-		v2d->op.fg = Viv2DColour(Viv2DGetFirstPixel(&pSrc->drawable), src_fmt.depth);
+		v2d->op.fg = Viv2DColour(Viv2DGetFirstPixel(pSrc), src_fmt.depth);
 #else
 		v2d->op.src_type = viv2d_src_stretch;
 #endif
@@ -2141,7 +4369,7 @@ static Bool Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 #ifdef VIV2D_1X1_REPEAT_AS_SOLID
 // armada way
 			v2d->op.msk_type = viv2d_src_clear;
-			v2d->op.mask = Viv2DColour(Viv2DGetFirstPixel(&pMask->drawable), msk_fmt.depth);
+			v2d->op.mask = Viv2DColour(Viv2DGetFirstPixel(pMask), msk_fmt.depth);
 #else
 			v2d->op.msk_type = viv2d_src_stretch;
 #endif
@@ -2167,6 +4395,24 @@ static Bool Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
 	v2d->op.dst = dst;
 	v2d->op.msk = msk;
 
+#ifdef VIV2D_SCALE_TRANSFORM
+	if (src && pSrcPicture->transform)
+		Viv2DOpScaleSource(v2d, pSrcPicture);
+#endif
+
+#ifdef VIV2D_REPEAT_TILE
+	if (src && v2d->op.src_type == viv2d_src_pix && pSrcPicture->repeat) {
+		v2d->op.src_tile_w = pSrc->drawable.width;
+		v2d->op.src_tile_h = pSrc->drawable.height;
+		Viv2DOpExpandTile(v2d);
+	}
+
+	if (msk && v2d->op.msk_type == viv2d_src_pix && pMaskPicture->repeat) {
+		v2d->op.msk_tile_w = pMask->drawable.width;
+		v2d->op.msk_tile_h = pMask->drawable.height;
+	}
+#endif
+
 #ifdef VIV2D_MASK_COMPONENT_SUPPORT
 	if (pMaskPicture && pMaskPicture->componentAlpha) {
 		v2d->op.has_component_alpha = TRUE;
@@ -2317,11 +4563,111 @@ static Bool Viv2DPrepareComposite(int rop, PicturePtr pSrcPicture,
      *
      * This call is required if PrepareComposite() ever succeeds.
      */
-// dest = (source IN mask) OP dest
+enum viv2d_mask_pass {
+	viv2d_mask_pass_src = 0, // src to tmp
+	viv2d_mask_pass_msk, // mask IN tmp
+	viv2d_mask_pass_dst // tmp OP dst
+};
+
+// stream the rects of one masked composite pass, its states being set:
+// a single DRAW_2D run when the source does not move, else one source
+// origin per rect
+static void Viv2DMaskPassRects(Viv2DRec *v2d, int src_type, int pass)
+{
+	Viv2DOp *op = &v2d->op;
+
+	op->cur_rect = 0;
+	for (int i = 0; i < op->cur_mrect; i++) {
+		Viv2DMaskRect *m = &op->mrects[i];
+		Viv2DRect *rect = pass == viv2d_mask_pass_dst ? &m->dst : &m->tmp;
+		int width = m->dst.x2 - m->dst.x1;
+		int height = m->dst.y2 - m->dst.y1;
+
+		if (src_type == viv2d_src_pix) {
+			switch (pass) {
+			case viv2d_mask_pass_src:
+				_Viv2DStreamCompRects(v2d, src_type, m->src_x, m->src_y, width, height, rect, 1);
+				break;
+			case viv2d_mask_pass_msk:
+				_Viv2DStreamCompRects(v2d, src_type, m->msk_x, m->msk_y, width, height, rect, 1);
+				break;
+			default:
+				_Viv2DStreamCompRects(v2d, src_type, m->tmp.x1, m->tmp.y1, width, height, rect, 1);
+				break;
+			}
+			continue;
+		}
+
+		if (!_Viv2DOpGrowRects(op)) {
+			_Viv2DStreamCompRects(v2d, src_type, 0, 0, 0, 0, op->rects, op->cur_rect);
+			op->cur_rect = 0;
+		}
+		op->rects[op->cur_rect++] = *rect;
+	}
+
+	if (op->cur_rect > 0)
+		_Viv2DStreamCompRects(v2d, src_type, 0, 0, 0, 0, op->rects, op->cur_rect);
+	op->cur_rect = 0;
+
+	// the next pass reads what this one wrote
+	if (_Viv2DStreamReserveOp(v2d, VIV2D_CACHE_FLUSH_RES))
+		_Viv2DStreamCacheFlush(v2d);
+}
+
+// run the three passes of the masked composite rects batched in the op scratch
+static void Viv2DMaskFlush(Viv2DRec *v2d)
+{
+	Viv2DOp *op = &v2d->op;
+	Viv2DBlendOp *cpy_op = &viv2d_blend_op[PictOpSrc];
+	Viv2DBlendOp msk_op = viv2d_blend_op[PictOpInReverse];
+
+	if (op->cur_mrect == 0)
+		return;
+
+#ifdef VIV2D_MASK_COMPONENT_SUPPORT
+	if (op->has_component_alpha) {
+		msk_op.src_blend_mode = DE_BLENDMODE_ZERO;
+		msk_op.dst_blend_mode = DE_BLENDMODE_COLOR;
+	}
+#endif
+
+	if (!_Viv2DStreamReserveComp(v2d, op->src_type, 0, TRUE))
+		goto drop;
+	_Viv2DStreamCompAlphaSetup(v2d, op->src_type, op->src, &op->src_fmt, op->fg, op->tmp, cpy_op,
+	                           op->src_alpha_mode_global, op->src_alpha,
+	                           FALSE, 0,
+	                           0, 0, 0, 0);
+	Viv2DMaskPassRects(v2d, op->src_type, viv2d_mask_pass_src);
+
+	if (!_Viv2DStreamReserveComp(v2d, op->msk_type, 0, TRUE))
+		goto drop;
+	_Viv2DStreamCompAlphaSetup(v2d, op->msk_type, op->msk, &op->msk_fmt, op->mask, op->tmp, &msk_op,
+	                           op->msk_alpha_mode_global, op->msk_alpha,
+	                           FALSE, 0,
+	                           0, 0, 0, 0);
+	Viv2DMaskPassRects(v2d, op->msk_type, viv2d_mask_pass_msk);
+
+	if (!_Viv2DStreamReserveComp(v2d, viv2d_src_pix, 0, op->blend_op != NULL))
+		goto drop;
+	_Viv2DStreamCompAlphaSetup(v2d, viv2d_src_pix, op->tmp, &op->tmp->format, 0, op->dst, op->blend_op,
+	                           FALSE, 0,
+	                           op->dst_alpha_mode_global, op->dst_alpha,
+	                           0, 0, 0, 0);
+	Viv2DMaskPassRects(v2d, viv2d_src_pix, viv2d_mask_pass_dst);
+
+	VIV2D_DBG_MSG("Viv2DMaskFlush rects:%d %d", op->cur_mrect, v2d->stream->offset);
+	_Viv2DOpResetTmp(op);
+	return;
+
+drop:
+	// the reserve logged the failure, the batched rects are lost
+	_Viv2DOpResetTmp(op);
+}
+
+// dest = (source IN mask) OP dest, for a rect not crossing a tile edge
 static void
-Viv2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
-               int dstX, int dstY, int width, int height) {
-	Viv2DRec *v2d = Viv2DPrivFromPixmap(pDst);
+Viv2DCompositeRect(Viv2DRec *v2d, int srcX, int srcY, int maskX, int maskY,
+                   int dstX, int dstY, int width, int height) {
 	Viv2DRect mrect[1], drect[1];
 
 	mrect[0].x1 = 0;
@@ -2334,13 +4680,47 @@ Viv2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
 	drect[0].x2 = dstX + width;
 	drect[0].y2 = dstY + height;
 
-	if (v2d->op.has_mask) {
-		// tmp 32bits argb pix
+	if (v2d->op.has_mask && width <= VIV2D_MASK_TMP_SIZE && height <= VIV2D_MASK_TMP_SIZE) {
+		Viv2DOp *op = &v2d->op;
+		Viv2DMaskRect *m;
+
+		// one scratch for the whole op, allocated on first use
+		if (!op->tmp) {
+			op->tmp = _Viv2DOpCreateTmpPix(v2d, VIV2D_MASK_TMP_SIZE, VIV2D_MASK_TMP_SIZE, 32);
+			_Viv2DSetFormat(32, 32, &op->tmp->format); // A8R8G8B8
+		}
+
+		if (!_Viv2DOpGrowMaskRects(op)) {
+			Viv2DMaskFlush(v2d);
+		}
+
+		m = &op->mrects[op->cur_mrect];
+		if (!_Viv2DOpPackTmp(op, width, height, &m->tmp)) {
+			Viv2DMaskFlush(v2d);
+			m = &op->mrects[op->cur_mrect];
+			_Viv2DOpPackTmp(op, width, height, &m->tmp);
+		}
+
+		m->src_x = srcX;
+		m->src_y = srcY;
+		m->msk_x = maskX;
+		m->msk_y = maskY;
+		m->dst = drect[0];
+		op->cur_mrect++;
+
+		// later rects would read what this one writes
+		if (op->src == op->dst || op->msk == op->dst)
+			Viv2DMaskFlush(v2d);
+	} else if (v2d->op.has_mask) {
+		// too large for the op scratch: tmp 32bits argb pix
 		Viv2DPixmapPrivPtr tmp;
 
 		Viv2DBlendOp *cpy_op = &viv2d_blend_op[PictOpSrc];
 		Viv2DBlendOp msk_op = viv2d_blend_op[PictOpInReverse];
 
+		// keep the order of the rects batched before
+		Viv2DMaskFlush(v2d);
+
 #ifdef VIV2D_MASK_COMPONENT_SUPPORT
 		if (v2d->op.has_component_alpha) {
 			msk_op.src_blend_mode = DE_BLENDMODE_ZERO;
@@ -2374,7 +4754,7 @@ Viv2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
 		_Viv2DOpDelTmpPix(v2d, tmp);
 	} else {
 		// new srcX,srcY group
-		if (v2d->op.prev_src_x != srcX || v2d->op.prev_src_y != srcY || v2d->op.cur_rect >= VIV2D_MAX_RECTS)
+		if (v2d->op.prev_src_x != srcX || v2d->op.prev_src_y != srcY || !_Viv2DOpGrowRects(&v2d->op))
 		{
 			// stream previous rects
 			if (v2d->op.prev_src_x > -1) {
@@ -2394,12 +4774,94 @@ Viv2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
 		v2d->op.prev_height = height;
 
 	}
+}
+
+#ifdef VIV2D_REPEAT_TILE
+// offset of pos in a repeating tile of size tile, 0 meaning no repeat
+static inline int Viv2DTileOffset(int pos, int tile) {
+	if (tile == 0)
+		return pos;
+	pos %= tile;
+	return pos < 0 ? pos + tile : pos;
+}
+
+// length of the span starting at src/msk up to the next tile edge of either
+static inline int Viv2DTileSpan(int len, int src, int src_tile, int msk, int msk_tile) {
+	if (src_tile && src_tile - src < len)
+		len = src_tile - src;
+	if (msk_tile && msk_tile - msk < len)
+		len = msk_tile - msk;
+	return len;
+}
+#endif
+
+static void
+Viv2DComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
+               int dstX, int dstY, int width, int height) {
+	Viv2DRec *v2d = Viv2DPrivFromPixmap(pDst);
+	Viv2DOp *op = &v2d->op;
+
+#ifdef VIV2D_SCALE_TRANSFORM
+	if (op->src_transform) {
+		// outside the scaled src the src is transparent and the op leaves
+		// dst untouched: clip to it
+		int x1, y1, x2, y2;
+
+		srcX += op->src_off_x;
+		srcY += op->src_off_y;
+		x1 = max(srcX, 0);
+		y1 = max(srcY, 0);
+		x2 = min(srcX + width, op->src->width);
+		y2 = min(srcY + height, op->src->height);
+		if (x1 >= x2 || y1 >= y2)
+			return;
+
+		maskX += x1 - srcX;
+		maskY += y1 - srcY;
+		dstX += x1 - srcX;
+		dstY += y1 - srcY;
+		srcX = x1;
+		srcY = y1;
+		width = x2 - x1;
+		height = y2 - y1;
+	}
+#endif
+
+#ifdef VIV2D_REPEAT_TILE
+	if (op->src_tile_w || op->msk_tile_w) {
+		// RepeatNormal: split at the tile edges, every piece reads one tile.
+		// pieces of the same source origin follow each other and go out
+		// as one DRAW_2D
+		int sy = Viv2DTileOffset(srcY, op->src_tile_h);
+		int my = Viv2DTileOffset(maskY, op->msk_tile_h);
+
+		for (int y = 0; y < height;) {
+			int h = Viv2DTileSpan(height - y, sy, op->src_tile_h, my, op->msk_tile_h);
+			int sx = Viv2DTileOffset(srcX, op->src_tile_w);
+			int mx = Viv2DTileOffset(maskX, op->msk_tile_w);
+
+			for (int x = 0; x < width;) {
+				int w = Viv2DTileSpan(width - x, sx, op->src_tile_w, mx, op->msk_tile_w);
+
+				Viv2DCompositeRect(v2d, sx, sy, mx, my, dstX + x, dstY + y, w, h);
+
+				x += w;
+				sx = Viv2DTileOffset(sx + w, op->src_tile_w);
+				mx = Viv2DTileOffset(mx + w, op->msk_tile_w);
+			}
+
+			y += h;
+			sy = Viv2DTileOffset(sy + h, op->src_tile_h);
+			my = Viv2DTileOffset(my + h, op->msk_tile_h);
+		}
+	} else
+#endif
+	Viv2DCompositeRect(v2d, srcX, srcY, maskX, maskY, dstX, dstY, width, height);
 
 	VIV2D_DBG_MSG("Viv2DComposite (src:%p(%dx%d) IN msk:%dx%d) OP dst:%p(%dx%d:%dx%d) : %dx%d src_type:%d fg:%x msk_type:%d has_mask:%d mask:%x",
 	              v2d->op.src, srcX, srcY, maskX, maskY,
 	              v2d->op.dst, dstX, dstY, v2d->op.dst->width, v2d->op.dst->height,
 	              width, height, v2d->op.src_type, v2d->op.fg, v2d->op.msk_type, v2d->op.has_mask, v2d->op.mask);
-
 }
 
 /**
@@ -2421,8 +4883,12 @@ static void Viv2DDoneComposite (PixmapPtr pDst) {
 	Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
 
 	if (v2d->op.has_mask) {
+		Viv2DMaskFlush(v2d);
+		if (v2d->op.tmp) {
+			_Viv2DOpDelTmpPix(v2d, v2d->op.tmp);
+			v2d->op.tmp = NULL;
+		}
 		VIV2D_DBG_MSG("Viv2DDoneComposite with msk dst:%p %d", pDst, v2d->stream->offset);
-		// already done masked operations
 	} else {
 		// last op
 		if (v2d->op.cur_rect > 0) {
@@ -2431,7 +4897,24 @@ static void Viv2DDoneComposite (PixmapPtr pDst) {
 			                      v2d->op.rects, v2d->op.cur_rect);
 			VIV2D_DBG_MSG("Viv2DDoneComposite dst:%p %d", pDst, v2d->stream->offset);
 		}
+		// a single PE cache flush for the whole op
+		if (_Viv2DStreamReserveOp(v2d, VIV2D_CACHE_FLUSH_RES))
+			_Viv2DStreamCacheFlush(v2d);
+	}
+
+#ifdef VIV2D_REPEAT_TILE
+	if (v2d->op.tile) {
+		_Viv2DOpDelTmpPix(v2d, v2d->op.tile);
+		v2d->op.tile = NULL;
+	}
+#endif
+
+#ifdef VIV2D_SCALE_TRANSFORM
+	if (v2d->op.scaled) {
+		_Viv2DOpDelTmpPix(v2d, v2d->op.scaled);
+		v2d->op.scaled = NULL;
 	}
+#endif
 
 #ifdef VIV2D_TRACE
 	_Viv2DStreamCommit(v2d, TRUE);
@@ -2465,15 +4948,55 @@ CloseScreen(ScreenPtr pScreen)
 	ScrnInfoPtr pScrn = xf86ScreenToScrn(pScreen);
 	struct ARMSOCRec *pARMSOC = ARMSOCPTR(pScrn);
 	Viv2DRec *v2d = Viv2DPrivFromARMSOC(pARMSOC);
+	uint32_t slow_lookups = 0;
 
 #ifdef VIV2D_FLUSH_CALLBACK
 	DeleteCallback(&FlushCallback, Viv2DFlushCallback, pScrn);
 #endif
 
+#ifdef VIV2D_SUPPORT_MONO
+	if (v2d->CreateGC)
+		pScreen->CreateGC = v2d->CreateGC;
+	Viv2DMonoFini(v2d);
+#endif
+#ifdef VIV2D_GRADIENT
+	if (v2d->Composite)
+		GetPictureScreen(pScreen)->Composite = v2d->Composite;
+	for (int i = 0; i < VIV2D_GRADIENT_CACHE_COUNT; i++)
+		Viv2DGradientStripFree(v2d, &v2d->gradient_cache[i]);
+#endif
+
 	_Viv2DStreamCommit(v2d, FALSE);
+#ifdef VIV2D_PLACEMENT
+	INFO_MSG("Viv2DEXA: migrated %llu bytes of pixmaps to malloc, %llu to bos",
+			(unsigned long long)v2d->migrated_to_cpu, (unsigned long long)v2d->migrated_to_gpu);
+#endif
+#ifdef VIV2D_USERPTR
+	Viv2DUserptrDrop(v2d);
+#endif
+#ifdef VIV2D_UPLOAD_TO_SCREEN
+	Viv2DStagingFini(v2d);
+#endif
+#ifdef VIV2D_DOWNLOAD_FROM_SCREEN
+	Viv2DReadbackFini(v2d);
+#endif
+#ifdef VIV2D_SUBMIT_THREAD
+	if (v2d->submit)
+		Viv2DSubmitQueueDel(v2d->submit);
+#endif
 
 	etna_bo_del(v2d->bo);
-	etna_cmd_stream_del(v2d->stream);
+	for (int i = 0; i < VIV2D_GLYPH_ATLAS_COUNT; i++) {
+		if (v2d->glyph_atlas[i].bo)
+			etna_bo_del(v2d->glyph_atlas[i].bo);
+	}
+	for (int i = 0; i < VIV2D_STREAM_COUNT; i++) {
+		slow_lookups += etna_cmd_stream_slow_lookups(v2d->streams[i]);
+		etna_cmd_stream_del_hashed(v2d->streams[i]);
+	}
+	INFO_MSG("Viv2DEXA: %u reloc bo lookups missed the current stream", slow_lookups);
+	free(v2d->op.rects);
+	free(v2d->op.mrects);
 	etna_pipe_del(v2d->pipe);
 	etna_gpu_del(v2d->gpu);
 	etna_bo_cache_destroy(v2d->dev);
@@ -2589,6 +5112,100 @@ static void etnaviv_init_filter_kernel(void)
 }
 
 
+#ifdef VIV2D_SCALE_TRANSFORM
+// scale the whole src into dst with the filter blit, horizontal pass into a
+// dst width x src height scratch then vertical pass, as Viv2DPutTextureImage
+static void Viv2DFilterScale(Viv2DRec *v2d, Viv2DPixmapPrivPtr src, Viv2DPixmapPrivPtr dst)
+{
+	Viv2DPixmapPrivPtr tmp;
+	uint32_t v_scale, h_scale;
+	int reserve;
+
+	tmp = _Viv2DOpCreateTmpPix(v2d, dst->width, src->height, dst->format.bpp);
+	tmp->format = dst->format;
+
+	h_scale = ((src->width - 1) << 16) / (dst->width - 1);
+	v_scale = ((src->height - 1) << 16) / (dst->height - 1);
+
+	reserve = 8 + 14 + 2 + 4 + 6 + 10; // horizontal
+	reserve += 8 + 14 + 2 + 4 + 6 + 10; // vertical
+	reserve += KERNEL_STATE_SZ + 1; // filter kernel
+	reserve += VIV2D_CACHE_FLUSH_RES;
+
+	_Viv2DStreamReserve(v2d, reserve);
+
+	etna_set_state_multi(v2d->stream, VIVS_DE_FILTER_KERNEL(0), KERNEL_STATE_SZ,
+	                     xv_filter_kernel);
+
+	etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, src->offset, ETNA_RELOC_READ);
+	src->batch = v2d->batch_serial;
+	etna_set_state(v2d->stream, VIVS_DE_SRC_STRIDE, src->pitch);
+	etna_set_state(v2d->stream, VIVS_DE_SRC_ROTATION_CONFIG, 0);
+	etna_set_state(v2d->stream, VIVS_DE_SRC_CONFIG, Viv2DSrcConfig(&dst->format));
+
+	_Viv2DStreamDst(v2d, tmp, VIVS_DE_DEST_CONFIG_COMMAND_HOR_FILTER_BLT, ROP_SRC, NULL);
+	etna_set_state(v2d->stream, VIVS_DE_ALPHA_CONTROL,
+	               VIVS_DE_ALPHA_CONTROL_ENABLE_OFF);
+	etna_set_state(v2d->stream, VIVS_DE_STRETCH_FACTOR_LOW,
+	               VIVS_DE_STRETCH_FACTOR_LOW_X(h_scale));
+	etna_set_state(v2d->stream, VIVS_DE_STRETCH_FACTOR_HIGH,
+	               VIVS_DE_STRETCH_FACTOR_HIGH_Y(1 << 16));
+	etna_set_state(v2d->stream, VIVS_DE_VR_CONFIG_EX, 0);
+	etna_set_state(v2d->stream, VIVS_DE_VR_SOURCE_IMAGE_LOW,
+	               VIVS_DE_VR_SOURCE_IMAGE_LOW_LEFT(0) |
+	               VIVS_DE_VR_SOURCE_IMAGE_LOW_TOP(0));
+	etna_set_state(v2d->stream, VIVS_DE_VR_SOURCE_IMAGE_HIGH,
+	               VIVS_DE_VR_SOURCE_IMAGE_HIGH_RIGHT(src->width) |
+	               VIVS_DE_VR_SOURCE_IMAGE_HIGH_BOTTOM(src->height));
+	etna_set_state(v2d->stream, VIVS_DE_VR_SOURCE_ORIGIN_LOW, VIVS_DE_VR_SOURCE_ORIGIN_LOW_X(0));
+	etna_set_state(v2d->stream, VIVS_DE_VR_SOURCE_ORIGIN_HIGH, VIVS_DE_VR_SOURCE_ORIGIN_HIGH_Y(0));
+	etna_set_state(v2d->stream, VIVS_DE_VR_TARGET_WINDOW_LOW,
+	               VIVS_DE_VR_TARGET_WINDOW_LOW_LEFT(0) |
+	               VIVS_DE_VR_TARGET_WINDOW_LOW_TOP(0));
+	etna_set_state(v2d->stream, VIVS_DE_VR_TARGET_WINDOW_HIGH,
+	               VIVS_DE_VR_TARGET_WINDOW_HIGH_RIGHT(tmp->width) |
+	               VIVS_DE_VR_TARGET_WINDOW_HIGH_BOTTOM(tmp->height));
+	etna_set_state(v2d->stream, VIVS_DE_VR_CONFIG, VIVS_DE_VR_CONFIG_START_HORIZONTAL_BLIT);
+
+	etna_set_state_from_bo(v2d->stream, VIVS_DE_SRC_ADDRESS, tmp->bo, ETNA_RELOC_READ);
+	etna_set_state(v2d->stream, VIVS_DE_SRC_STRIDE, tmp->pitch);
+	etna_set_state(v2d->stream, VIVS_DE_SRC_ROTATION_CONFIG, 0);
+	etna_set_state(v2d->stream, VIVS_DE_SRC_CONFIG, Viv2DSrcConfig(&tmp->format));
+
+	_Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_VER_FILTER_BLT, ROP_SRC, NULL);
+	etna_set_state(v2d->stream, VIVS_DE_ALPHA_CONTROL,
+	               VIVS_DE_ALPHA_CONTROL_ENABLE_OFF);
+	etna_set_state(v2d->stream, VIVS_DE_STRETCH_FACTOR_LOW,
+	               VIVS_DE_STRETCH_FACTOR_LOW_X(1 << 16));
+	etna_set_state(v2d->stream, VIVS_DE_STRETCH_FACTOR_HIGH,
+	               VIVS_DE_STRETCH_FACTOR_HIGH_Y(v_scale));
+	etna_set_state(v2d->stream, VIVS_DE_VR_CONFIG_EX, 0);
+	etna_set_state(v2d->stream, VIVS_DE_VR_SOURCE_IMAGE_LOW,
+	               VIVS_DE_VR_SOURCE_IMAGE_LOW_LEFT(0) |
+	               VIVS_DE_VR_SOURCE_IMAGE_LOW_TOP(0));
+	etna_set_state(v2d->stream, VIVS_DE_VR_SOURCE_IMAGE_HIGH,
+	               VIVS_DE_VR_SOURCE_IMAGE_HIGH_RIGHT(tmp->width) |
+	               VIVS_DE_VR_SOURCE_IMAGE_HIGH_BOTTOM(tmp->height));
+	etna_set_state(v2d->stream, VIVS_DE_VR_SOURCE_ORIGIN_LOW, VIVS_DE_VR_SOURCE_ORIGIN_LOW_X(0));
+	etna_set_state(v2d->stream, VIVS_DE_VR_SOURCE_ORIGIN_HIGH, VIVS_DE_VR_SOURCE_ORIGIN_HIGH_Y(0));
+	etna_set_state(v2d->stream, VIVS_DE_VR_TARGET_WINDOW_LOW,
+	               VIVS_DE_VR_TARGET_WINDOW_LOW_LEFT(0) |
+	               VIVS_DE_VR_TARGET_WINDOW_LOW_TOP(0));
+	etna_set_state(v2d->stream, VIVS_DE_VR_TARGET_WINDOW_HIGH,
+	               VIVS_DE_VR_TARGET_WINDOW_HIGH_RIGHT(dst->width) |
+	               VIVS_DE_VR_TARGET_WINDOW_HIGH_BOTTOM(dst->height));
+	etna_set_state(v2d->stream, VIVS_DE_VR_CONFIG, VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT);
+
+	_Viv2DStreamCacheFlush(v2d);
+
+	// raw states above bypass the shadow
+	_Viv2DStateInvalidate(v2d);
+
+	// back to the bo cache, only later commands of the stream can reuse it
+	_Viv2DOpDelTmpPix(v2d, tmp);
+}
+#endif
+
 #ifdef VIV2D_PUT_TEXTURE_IMAGE
 // NOTE: filter blit VIVS_DE_VR_SOURCE_IMAGE* does not work, so we need to convert to an intermediate surface before doing a standard bitblt
 // there is room for optimization, since in case of clipping we convert the full source for each clip
@@ -2653,7 +5270,8 @@ static Bool Viv2DPutTextureImage(PixmapPtr pSrcPix, BoxPtr pSrcBox,
 	                     xv_filter_kernel);
 
 	// 8
-	etna_set_state_from_bo(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, ETNA_RELOC_READ);
+	etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, src->offset, ETNA_RELOC_READ);
+	src->batch = v2d->batch_serial;
 	etna_set_state(v2d->stream, VIVS_DE_SRC_STRIDE, src->pitch);
 	etna_set_state(v2d->stream, VIVS_DE_SRC_ROTATION_CONFIG, 0);
 	etna_set_state(v2d->stream, VIVS_DE_SRC_CONFIG, Viv2DSrcConfig(&src->format));
@@ -2663,9 +5281,11 @@ static Bool Viv2DPutTextureImage(PixmapPtr pSrcPix, BoxPtr pSrcBox,
 		Viv2DPixmapPrivPtr upix = Viv2DPixmapPrivFromPixmap(extraPix[0]);
 		Viv2DPixmapPrivPtr vpix = Viv2DPixmapPrivFromPixmap(extraPix[1]);
 
-		etna_set_state_from_bo(v2d->stream, VIVS_DE_UPLANE_ADDRESS, upix->bo, ETNA_RELOC_READ);
+		upix->batch = v2d->batch_serial;
+		vpix->batch = v2d->batch_serial;
+		etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_UPLANE_ADDRESS, upix->bo, upix->offset, ETNA_RELOC_READ);
 		etna_set_state(v2d->stream, VIVS_DE_UPLANE_STRIDE, upix->pitch);
-		etna_set_state_from_bo(v2d->stream, VIVS_DE_VPLANE_ADDRESS, vpix->bo, ETNA_RELOC_READ);
+		etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_VPLANE_ADDRESS, vpix->bo, vpix->offset, ETNA_RELOC_READ);
 		etna_set_state(v2d->stream, VIVS_DE_VPLANE_STRIDE, vpix->pitch);
 	}
 
@@ -2743,6 +5363,9 @@ static Bool Viv2DPutTextureImage(PixmapPtr pSrcPix, BoxPtr pSrcBox,
 	               VIVS_DE_VR_TARGET_WINDOW_HIGH_BOTTOM(pDstBox->y2));
 	etna_set_state(v2d->stream, VIVS_DE_VR_CONFIG, VIVS_DE_VR_CONFIG_START_VERTICAL_BLIT);
 
+	// raw states above bypass the shadow
+	_Viv2DStateInvalidate(v2d);
+
 	_Viv2DStreamCommit(v2d, TRUE);
 //	etna_cmd_stream_finish(v2d->stream);
 	VIV2D_DBG_MSG("Viv2DPutTextureImage %d src:%p/%p(%dx%d) %d %dx%d:%dx%d %s/%s dst:%p/%p(%dx%d) %d %dx%d:%dx%d %s/%s full:%dx%d:%dx%d tmp:%dx%d %d : %dx%d",
@@ -2812,6 +5435,24 @@ static Bool LS_PixmapIsOffscreen(PixmapPtr pPixmap)
 
 
 
+#ifdef VIV2D_PLACEMENT
+// placement thresholds, counts never get past VIV2D_CACHED_WINDOW
+static void Viv2DPlacementInit(Viv2DRec *v2d, ScrnInfoPtr pScrn)
+{
+	loongsonRecPtr pLs = loongsonPTR(pScrn);
+
+	v2d->place_to_cpu = VIV2D_PLACE_TO_CPU;
+	v2d->place_to_gpu = VIV2D_PLACE_TO_GPU;
+	xf86GetOptValInteger(pLs->pOptionInfo, OPTION_MIGRATE_TO_CPU, &v2d->place_to_cpu);
+	xf86GetOptValInteger(pLs->pOptionInfo, OPTION_MIGRATE_TO_GPU, &v2d->place_to_gpu);
+	v2d->place_to_cpu = max(0, min(v2d->place_to_cpu, VIV2D_CACHED_WINDOW));
+	v2d->place_to_gpu = max(0, min(v2d->place_to_gpu, VIV2D_CACHED_WINDOW));
+
+	INFO_MSG("Viv2DEXA: pixmaps to malloc after %d cpu accesses, to bos after %d refused gpu ops",
+			v2d->place_to_cpu, v2d->place_to_gpu);
+}
+#endif
+
 struct ARMSOCEXARec * InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 {
 
@@ -2851,6 +5492,9 @@ struct ARMSOCEXARec * InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 
     int scanoutFD;
     uint64_t model, revision;
+#ifdef VIV2D_SUPPORT_A8_DST
+    uint64_t minor_features4;
+#endif
 
 
 	etna_bo_cache_init(v2d->dev);
@@ -2865,18 +5509,50 @@ struct ARMSOCEXARec * InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 	etna_gpu_get_param(v2d->gpu, ETNA_GPU_REVISION, &revision);
 	INFO_MSG("Viv2DEXA: Vivante GC%x GPU revision %x found !", (uint32_t)model, (uint32_t)revision);
 
+#ifdef VIV2D_SUPPORT_A8_DST
+	etna_gpu_get_param(v2d->gpu, ETNA_GPU_FEATURES_5, &minor_features4);
+	v2d->a8_target = (minor_features4 & VIV2D_MINOR_FEATURES4_2D_A8_TARGET) != 0;
+	INFO_MSG("Viv2DEXA: A8 destination %s", v2d->a8_target ? "supported" : "emulated for fills");
+#endif
+
+#ifdef VIV2D_PLACEMENT
+	Viv2DPlacementInit(v2d, pScrn);
+#endif
+
 	v2d->pipe = etna_pipe_new(v2d->gpu, ETNA_PIPE_2D);
 	if (!v2d->pipe) {
 		ERROR_MSG("Viv2DEXA: Failed to create pipe");
 		goto fail;
 	}
 
-	v2d->stream = etna_cmd_stream_new(v2d->pipe, VIV2D_STREAM_SIZE, NULL, NULL);
-	if (!v2d->stream)
-    {
-		ERROR_MSG("Viv2DEXA: Failed to create stream");
+	for (int i = 0; i < VIV2D_STREAM_COUNT; i++)
+	{
+		v2d->streams[i] = etna_cmd_stream_new_hashed(v2d->pipe, VIV2D_STREAM_SIZE);
+		if (!v2d->streams[i])
+		{
+			ERROR_MSG("Viv2DEXA: Failed to create stream %d", i);
+			goto fail;
+		}
+		v2d->stream_fence[i] = 0;
+		v2d->stream_serial[i] = 0;
+	}
+	v2d->cur_stream = 0;
+	v2d->stream = v2d->streams[0];
+	_Viv2DStateInvalidate(v2d);
+
+	if (!_Viv2DOpGrowRects(&v2d->op) || !_Viv2DOpGrowMaskRects(&v2d->op)) {
+		ERROR_MSG("Viv2DEXA: Failed to allocate rects");
 		goto fail;
 	}
+	v2d->last_fence = 0;
+	v2d->batch_serial = 1;
+	v2d->batch_start = GetTimeInMillis();
+
+#ifdef VIV2D_SUBMIT_THREAD
+	v2d->submit = Viv2DSubmitQueueNew();
+	if (v2d->submit)
+		INFO_MSG("Viv2DEXA: submitting from a worker thread");
+#endif
 
     int res = armsoc_bo_to_dmabuf(pARMSOC->scanout, &scanoutFD);
     if( res != 0 )
@@ -2983,6 +5659,18 @@ struct ARMSOCEXARec * InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 	ps->AddTraps = Viv2DAddTraps;
 	ps->Triangles = Viv2DTriangles;
 	ps->AddTriangles = Viv2DAddTriangles;
+#ifdef VIV2D_GRADIENT
+	v2d->Composite = ps->Composite;
+	ps->Composite = Viv2DGradientComposite;
+#endif
+#endif
+
+#ifdef VIV2D_SUPPORT_MONO
+	// core text, stipples and bitmaps
+	if (dixRegisterPrivateKey(&viv2d_gc_key, PRIVATE_GC, sizeof(Viv2DGCPrivRec))) {
+		v2d->CreateGC = pScreen->CreateGC;
+		pScreen->CreateGC = Viv2DCreateGC;
+	}
 #endif
 
 	armsoc_exa->CloseScreen = CloseScreen;
@@ -2991,6 +5679,7 @@ struct ARMSOCEXARec * InitViv2DEXA(ScreenPtr pScreen, ScrnInfoPtr pScrn, int fd)
 	etnaviv_init_filter_kernel();
 
 	armsoc_exa->Flush = Viv2DFlush;
+	armsoc_exa->FlushFence = Viv2DFlushFence;
 	armsoc_exa->AllocBuf = Viv2DAllocBuf;
 	armsoc_exa->FreeBuf = Viv2DFreeBuf;
 	armsoc_exa->MapUsermemBuf = Viv2DMapUsermemBuf;
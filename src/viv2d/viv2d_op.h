@@ -9,6 +9,7 @@
 #include "cmdstream.xml.h"
 
 #include "viv2d.h"
+#include "viv2d_submit.h"
 
 #define ETNAVIV_WAIT_PIPE_MS 1000
 
@@ -34,17 +35,23 @@ static inline void etna_set_state(struct etna_cmd_stream *stream, uint32_t addre
 	etna_cmd_stream_emit(stream, value);
 }
 
-static inline void etna_set_state_from_bo(struct etna_cmd_stream *stream,
-        uint32_t address, struct etna_bo *bo, int flags)
+static inline void etna_set_state_from_bo_offset(struct etna_cmd_stream *stream,
+        uint32_t address, struct etna_bo *bo, uint32_t offset, int flags)
 {
 	etna_emit_load_state(stream, address >> 2, 1);
-	etna_cmd_stream_reloc(stream, &(struct etna_reloc) {
+	etna_cmd_stream_reloc_hashed(stream, &(struct etna_reloc) {
 		.bo = bo,
 		 .flags = flags,
-		  .offset = 0,
+		  .offset = offset,
 	});
 }
 
+static inline void etna_set_state_from_bo(struct etna_cmd_stream *stream,
+        uint32_t address, struct etna_bo *bo, int flags)
+{
+	etna_set_state_from_bo_offset(stream, address, bo, 0, flags);
+}
+
 static inline void etna_set_state_multi(struct etna_cmd_stream *stream, uint32_t base, uint32_t num, const uint32_t *values)
 {
 	int i;
@@ -62,7 +69,7 @@ static inline void etna_load_state(struct etna_cmd_stream *stream, uint32_t addr
 }
 
 static inline void etna_add_state_from_bo(struct etna_cmd_stream *stream, struct etna_bo *bo, int flags) {
-	etna_cmd_stream_reloc(stream, &(struct etna_reloc) {
+	etna_cmd_stream_reloc_hashed(stream, &(struct etna_reloc) {
 		.bo = bo,
 		 .flags = flags,
 		  .offset = 0,
@@ -79,6 +86,7 @@ static inline void etna_add_state(struct etna_cmd_stream *stream, uint32_t value
 #define VIV2D_SRC_SOLID_RES 2
 #define VIV2D_SRC_BRUSH_FILL_RES 8
 #define VIV2D_SRC_STRETCH_RES 4
+#define VIV2D_SRC_MONO_RES 4
 #define VIV2D_DEST_RES 10
 #define VIV2D_BLEND_ON_RES 8
 #define VIV2D_BLEND_OFF_RES 2
@@ -87,7 +95,18 @@ static inline void etna_add_state(struct etna_cmd_stream *stream, uint32_t value
 #else
 #define VIV2D_CACHE_FLUSH_RES 0
 #endif
-#define VIV2D_RECTS_RES(cnt) cnt*2+2
+// a DRAW_2D command takes at most 255 rects, each command adds 2 words
+#define VIV2D_DRAW_2D_MAX_RECTS 255
+#define VIV2D_RECTS_RES(cnt) ((cnt)*2+2*(((cnt)+VIV2D_DRAW_2D_MAX_RECTS-1)/VIV2D_DRAW_2D_MAX_RECTS))
+
+// every shadowed state group, see _Viv2DStateReplay
+#define VIV2D_STATE_RES (VIV2D_SRC_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_DEST_RES + VIV2D_BLEND_ON_RES + \
+                         VIV2D_SRC_SOLID_RES + VIV2D_SRC_BRUSH_FILL_RES + VIV2D_SRC_STRETCH_RES + VIV2D_SRC_MONO_RES)
+
+// the largest op continuation, a full rect batch, must fit an empty stream with its states
+#if VIV2D_STATE_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(VIV2D_OP_MAX_RECTS) + VIV2D_CACHE_FLUSH_RES > VIV2D_STREAM_SIZE - 2
+#error "VIV2D_OP_MAX_RECTS rects do not fit VIV2D_STREAM_SIZE"
+#endif
 
 static inline Bool _Viv2DSetFormat(unsigned int depth, unsigned int bpp, Viv2DFormat *fmt)
 {
@@ -122,6 +141,77 @@ static inline Bool _Viv2DSetFormat(unsigned int depth, unsigned int bpp, Viv2DFo
 	return TRUE;
 }
 
+// make room for one more rect, FALSE if the batch cannot grow and the
+// pending rects have to be streamed first. the batch stops growing at
+// VIV2D_OP_MAX_RECTS so its rects always fit a stream
+static inline Bool _Viv2DOpGrowRects(Viv2DOp *op) {
+	Viv2DRect *rects;
+	int max_rects;
+
+	if (op->cur_rect < op->max_rects)
+		return TRUE;
+
+	if (op->max_rects >= VIV2D_OP_MAX_RECTS)
+		return FALSE;
+
+	max_rects = op->max_rects ? op->max_rects * 2 : VIV2D_OP_RECTS;
+	rects = realloc(op->rects, max_rects * sizeof(*rects));
+	if (!rects)
+		return FALSE;
+
+	op->rects = rects;
+	op->max_rects = max_rects;
+	return TRUE;
+}
+
+static inline Bool _Viv2DOpGrowMaskRects(Viv2DOp *op) {
+	Viv2DMaskRect *mrects;
+	int max_mrects;
+
+	if (op->cur_mrect < op->max_mrects)
+		return TRUE;
+
+	max_mrects = op->max_mrects ? op->max_mrects * 2 : VIV2D_OP_RECTS;
+	mrects = realloc(op->mrects, max_mrects * sizeof(*mrects));
+	if (!mrects)
+		return FALSE;
+
+	op->mrects = mrects;
+	op->max_mrects = max_mrects;
+	return TRUE;
+}
+
+// place a width x height rect into the op scratch, shelf by shelf,
+// FALSE once the scratch is full
+static inline Bool _Viv2DOpPackTmp(Viv2DOp *op, int width, int height, Viv2DRect *rect) {
+	if (op->tmp_x + width > VIV2D_MASK_TMP_SIZE) {
+		op->tmp_x = 0;
+		op->tmp_y += op->tmp_shelf;
+		op->tmp_shelf = 0;
+	}
+
+	if (op->tmp_y + height > VIV2D_MASK_TMP_SIZE)
+		return FALSE;
+
+	rect->x1 = op->tmp_x;
+	rect->y1 = op->tmp_y;
+	rect->x2 = op->tmp_x + width;
+	rect->y2 = op->tmp_y + height;
+
+	op->tmp_x += width;
+	if (height > op->tmp_shelf)
+		op->tmp_shelf = height;
+
+	return TRUE;
+}
+
+static inline void _Viv2DOpResetTmp(Viv2DOp *op) {
+	op->cur_mrect = 0;
+	op->tmp_x = 0;
+	op->tmp_y = 0;
+	op->tmp_shelf = 0;
+}
+
 static inline void _Viv2DOpAddRect(Viv2DOp *op, int x, int y, int width, int height) {
 	Viv2DRect rect;
 	rect.x1 = x;
@@ -142,8 +232,25 @@ static inline void _Viv2DOpInit(Viv2DOp *op) {
 	op->dst = NULL;
 	op->src = NULL;
 	op->msk = NULL;
+	op->tmp = NULL;
+	_Viv2DOpResetTmp(op);
+	op->src_tile_w = 0;
+	op->src_tile_h = 0;
+	op->msk_tile_w = 0;
+	op->msk_tile_h = 0;
+	op->tile = NULL;
+	op->src_transform = FALSE;
+	op->src_off_x = 0;
+	op->src_off_y = 0;
+	op->scaled = NULL;
 	op->fg = 0;
 	op->mask = 0;
+	op->solid_and_xor = FALSE;
+	op->a8_dst = NULL;
+#ifdef VIV2D_SOLID_CACHE
+	op->solid_cache = FALSE;
+	op->solid_cover = FALSE;
+#endif
 }
 
 static inline int _VIV2DDumpStream(Viv2DPtr v2d) {
@@ -161,22 +268,122 @@ static inline int _VIV2DDumpStream(Viv2DPtr v2d) {
 	}
 }
 
+// forget the shadowed DE state, next ops emit their state in full.
+// used on submit: another context may run on the pipe between our
+// submits, and the relocs of the new stream must be emitted again.
+static inline void _Viv2DStateInvalidate(Viv2DPtr v2d) {
+	v2d->state.valid = 0;
+}
+
+#ifdef VIV2D_SUBMIT_THREAD
+// finish the streams submitted by the worker and collect their fences
+static inline void _Viv2DStreamRetire(Viv2DPtr v2d) {
+	Viv2DSubmitQueue *q = v2d->submit;
+	uint32_t tail = Viv2DSubmitQueueTail(q);
+
+	for (; q->retired != tail; q->retired++) {
+		int slot = q->retired % VIV2D_STREAM_COUNT;
+		Viv2DSubmitQueueFinish(q, slot);
+		v2d->stream_fence[slot] = q->fences[slot];
+		v2d->last_fence = q->fences[slot];
+	}
+}
+#endif
+
+// make sure every handed off stream reached the kernel and its fence is known,
+// only waits for the submit ioctls, not for the gpu
+static inline void _Viv2DStreamSync(Viv2DPtr v2d) {
+#ifdef VIV2D_SUBMIT_THREAD
+	if (v2d->submit) {
+		Viv2DSubmitQueueWait(v2d->submit, v2d->submit->head);
+		_Viv2DStreamRetire(v2d);
+	}
+#endif
+}
+
 static inline int _Viv2DStreamWait(Viv2DPtr v2d) {
+	_Viv2DStreamSync(v2d);
 	etna_bo_cache_clean(v2d->dev);
 //	VIV2D_DBG_MSG("_Viv2DStreamCommit pipe wait start");
-	int ret = etna_pipe_wait(v2d->pipe, etna_cmd_stream_timestamp(v2d->stream), ETNAVIV_WAIT_PIPE_MS);
+	int ret = etna_pipe_wait(v2d->pipe, v2d->last_fence, ETNAVIV_WAIT_PIPE_MS);
 	if (ret != 0) {
 		VIV2D_INFO_MSG("wait pipe failed");
 	}
 	return ret;
 }
 
+// submit the stream being built, tag its ring slot with the submit fence
+// and continue building into the next slot. with fence_fd, also get a
+// sync_file fd signaled once the gpu is done with it (-1 on failure)
+static inline void _Viv2DStreamSubmitFence(Viv2DPtr v2d, int *fence_fd) {
+	int slot = v2d->cur_stream;
+
+	v2d->stream_serial[slot] = v2d->batch_serial++;
+#ifdef VIV2D_SUBMIT_THREAD
+	if (v2d->submit) {
+		// fence comes back through _Viv2DStreamRetire
+		v2d->stream_fence[slot] = 0;
+		Viv2DSubmitQueuePush(v2d->submit, v2d->stream, fence_fd != NULL);
+		if (fence_fd) {
+			Viv2DSubmitQueueWait(v2d->submit, v2d->submit->head);
+			_Viv2DStreamRetire(v2d);
+			*fence_fd = v2d->submit->fence_fds[slot];
+		}
+	} else
+#endif
+	{
+		etna_cmd_stream_submit(v2d->stream, fence_fd);
+		v2d->stream_fence[slot] = etna_cmd_stream_timestamp(v2d->stream);
+		v2d->last_fence = v2d->stream_fence[slot];
+	}
+
+	v2d->cur_stream = (slot + 1) % VIV2D_STREAM_COUNT;
+	v2d->stream = v2d->streams[v2d->cur_stream];
+	_Viv2DStateInvalidate(v2d);
+	// a new batch starts here, the first reserve in it dates it again
+	v2d->batch_start = GetTimeInMillis();
+
+#ifdef VIV2D_SUBMIT_THREAD
+	if (v2d->submit) {
+		// the next slot can only be rebuilt once the worker submitted it
+		Viv2DSubmitQueueWait(v2d->submit, v2d->submit->head - (VIV2D_STREAM_COUNT - 1));
+		_Viv2DStreamRetire(v2d);
+	}
+#endif
+
+	VIV2D_OP_DBG_MSG("_Viv2DStreamSubmit slot:%d fence:%d", slot, v2d->last_fence);
+}
+
+static inline void _Viv2DStreamSubmit(Viv2DPtr v2d) {
+	_Viv2DStreamSubmitFence(v2d, NULL);
+}
+
+// fence of a submitted batch serial. batches older than the ring map to
+// the oldest fence still in the ring, fences being monotonic this waits
+// at least as long as needed
+static inline uint32_t _Viv2DStreamSerialFence(Viv2DPtr v2d, uint32_t serial) {
+	int oldest = v2d->cur_stream; // next slot to be submitted again
+
+	for (int i = 0; i < VIV2D_STREAM_COUNT; i++) {
+		if (v2d->stream_fence[i] && v2d->stream_serial[i] == serial)
+			return v2d->stream_fence[i];
+	}
+
+	for (int i = 0; i < VIV2D_STREAM_COUNT; i++) {
+		int slot = (oldest + i) % VIV2D_STREAM_COUNT;
+		if (v2d->stream_fence[slot])
+			return v2d->stream_fence[slot];
+	}
+
+	return 0;
+}
+
 static inline void _Viv2DStreamCommit(Viv2DPtr v2d, Bool async) {
 //	VIV2D_DBG_MSG("_Viv2DStreamCommit %d %d (%d)", async, etna_cmd_stream_avail(v2d->stream), v2d->stream->offset);
 	if (etna_cmd_stream_offset(v2d->stream) > 0) {
 		VIV2D_DBG_MSG("_Viv2DStreamCommit flush start %d (%d)", etna_cmd_stream_avail(v2d->stream), v2d->stream->offset);
 //		_VIV2DDumpStream(v2d);
-		etna_cmd_stream_flush(v2d->stream);
+		_Viv2DStreamSubmit(v2d);
 //		VIV2D_DBG_MSG("_Viv2DStreamCommit flush end %d (%d)", etna_cmd_stream_avail(v2d->stream), v2d->stream->offset);
 	}
 
@@ -185,13 +392,165 @@ static inline void _Viv2DStreamCommit(Viv2DPtr v2d, Bool async) {
 	}
 }
 
-static inline void _Viv2DStreamReserve(Viv2DPtr v2d, size_t n)
+// grow the stream being built so n more words fit, FALSE past VIV2D_STREAM_MAX_SIZE
+static inline Bool _Viv2DStreamGrow(Viv2DPtr v2d, size_t n)
+{
+	struct etna_cmd_stream *stream = v2d->stream;
+	uint32_t size = stream->size;
+
+	while (etna_cmd_stream_avail(stream) + (size - stream->size) < n)
+		size *= 2;
+
+	if (size > VIV2D_STREAM_MAX_SIZE || etna_cmd_stream_grow(stream, size))
+		return FALSE;
+
+	VIV2D_OP_DBG_MSG("_Viv2DStreamGrow %d (%d)", size, stream->offset);
+	return TRUE;
+}
+
+// reserve n words at the start of an op, submitting what is queued if needed.
+// FALSE if n words do not fit even an empty stream, nothing may be emitted
+static inline Bool _Viv2DStreamReserve(Viv2DPtr v2d, size_t n)
 {
 	if (etna_cmd_stream_avail(v2d->stream) < n) {
 		VIV2D_OP_DBG_MSG("_Viv2DStreamReserve %d < %d (%d)", etna_cmd_stream_avail(v2d->stream), n, v2d->stream->offset);
-		etna_cmd_stream_flush(v2d->stream);
+		_Viv2DStreamSubmit(v2d);
+		if (etna_cmd_stream_avail(v2d->stream) < n && !_Viv2DStreamGrow(v2d, n)) {
+			VIV2D_ERR_MSG("_Viv2DStreamReserve %d words do not fit a stream", (int)n);
+			return FALSE;
+		}
+	}
+
+	if (etna_cmd_stream_offset(v2d->stream) == 0)
+		v2d->batch_start = GetTimeInMillis();
+	return TRUE;
+}
+
+// emit again the states shadowed in saved, in a stream that lost them
+// on submit, and take them as the known state
+static inline void _Viv2DStateReplay(Viv2DPtr v2d, const Viv2DState *saved) {
+	struct etna_cmd_stream *stream = v2d->stream;
+	uint32_t valid = saved->valid;
+
+	if (valid & VIV2D_STATE_SRC) {
+		if (saved->src_bo)
+			etna_set_state_from_bo_offset(stream, VIVS_DE_SRC_ADDRESS, saved->src_bo, saved->src_offset, ETNA_RELOC_READ);
+		etna_load_state(stream, VIVS_DE_SRC_STRIDE, 3);
+		etna_add_state(stream, saved->src_stride); // VIVS_DE_SRC_STRIDE
+		etna_add_state(stream, saved->src_bo ? VIVS_DE_SRC_ROTATION_CONFIG_ROTATION_DISABLE : 0); // VIVS_DE_SRC_ROTATION_CONFIG
+		etna_add_state(stream, saved->src_config); // VIVS_DE_SRC_CONFIG
+		if (saved->src_pix)
+			saved->src_pix->batch = v2d->batch_serial;
+	}
+	if (valid & VIV2D_STATE_SRC_ORIGIN) {
+		etna_set_state(stream, VIVS_DE_SRC_ORIGIN, saved->src_origin);
+		etna_set_state(stream, VIVS_DE_SRC_SIZE, saved->src_size);
+	}
+	if (valid & VIV2D_STATE_DST) {
+		etna_set_state_from_bo_offset(stream, VIVS_DE_DEST_ADDRESS, saved->dst_bo, saved->dst_offset, ETNA_RELOC_WRITE);
+		etna_load_state(stream, VIVS_DE_DEST_STRIDE, 3);
+		etna_add_state(stream, saved->dst_stride); // VIVS_DE_DEST_STRIDE
+		etna_add_state(stream, 0); // VIVS_DE_DEST_ROTATION_CONFIG
+		etna_add_state(stream, saved->dst_config); // VIVS_DE_DEST_CONFIG
+		if (saved->dst_pix)
+			saved->dst_pix->batch = v2d->batch_serial;
+	}
+	if (valid & VIV2D_STATE_ROP_CLIP) {
+		etna_load_state(stream, VIVS_DE_ROP, 3);
+		etna_add_state(stream, saved->rop); // VIVS_DE_ROP
+		etna_add_state(stream, saved->clip_tl); // VIVS_DE_CLIP_TOP_LEFT
+		etna_add_state(stream, saved->clip_br); // VIVS_DE_CLIP_BOTTOM_RIGHT
+	}
+	if (valid & VIV2D_STATE_ALPHA_CONTROL)
+		etna_set_state(stream, VIVS_DE_ALPHA_CONTROL, saved->alpha_control);
+	if (valid & VIV2D_STATE_ALPHA) {
+		etna_set_state(stream, VIVS_DE_ALPHA_MODES, saved->alpha_modes);
+		etna_load_state(stream, VIVS_DE_GLOBAL_SRC_COLOR, 3);
+		etna_add_state(stream, saved->global_src_color); // VIVS_DE_GLOBAL_SRC_COLOR
+		etna_add_state(stream, saved->global_dst_color); // VIVS_DE_GLOBAL_DEST_COLOR
+		etna_add_state(stream, saved->color_multiply); // VIVS_DE_COLOR_MULTIPLY_MODES
+	}
+	if (valid & VIV2D_STATE_CLEAR_COLOR)
+		etna_set_state(stream, VIVS_DE_CLEAR_PIXEL_VALUE32, saved->clear_color);
+	if (valid & VIV2D_STATE_PATTERN) {
+		etna_load_state(stream, VIVS_DE_PATTERN_HIGH, 5);
+		etna_add_state(stream, 0);
+		etna_add_state(stream, 0xffffffff);
+		etna_add_state(stream, 0xffffffff);
+		etna_add_state(stream, 0);
+		etna_add_state(stream, saved->pattern_color);
+		etna_set_state(stream, VIVS_DE_PATTERN_CONFIG, VIVS_DE_PATTERN_CONFIG_INIT_TRIGGER(3));
+	}
+	if (valid & VIV2D_STATE_STRETCH) {
+		etna_set_state(stream, VIVS_DE_STRETCH_FACTOR_LOW, saved->stretch_low);
+		etna_set_state(stream, VIVS_DE_STRETCH_FACTOR_HIGH, saved->stretch_high);
+	}
+	if (valid & VIV2D_STATE_MONO_COLOR) {
+		etna_load_state(stream, VIVS_DE_SRC_COLOR_BG, 2);
+		etna_add_state(stream, saved->mono_bg); // VIVS_DE_SRC_COLOR_BG
+		etna_add_state(stream, saved->mono_fg); // VIVS_DE_SRC_COLOR_FG
+		etna_cmd_stream_emit(stream, 0); // keep the next load state aligned
+	}
+
+	v2d->state = *saved;
+}
+
+// reserve n words to continue an op whose states are already in the
+// stream: grow it rather than split the op over two submits. past
+// VIV2D_STREAM_MAX_SIZE the op goes on in the next stream, its states
+// replayed first. FALSE if n words and the states do not fit an empty
+// stream: nothing is submitted, nothing may be emitted
+static inline Bool _Viv2DStreamReserveOp(Viv2DPtr v2d, size_t n)
+{
+	Viv2DState saved;
+
+	if (etna_cmd_stream_avail(v2d->stream) >= n || _Viv2DStreamGrow(v2d, n))
+		return TRUE;
+
+	// streams never shrink below VIV2D_STREAM_SIZE
+	if (VIV2D_STATE_RES + n > VIV2D_STREAM_SIZE - 2) {
+		VIV2D_ERR_MSG("_Viv2DStreamReserveOp %d words do not fit a stream", (int)n);
+		return FALSE;
+	}
+
+	saved = v2d->state;
+	_Viv2DStreamSubmit(v2d);
+	// whatever comes next in the op expects its states in place
+	_Viv2DStateReplay(v2d, &saved);
+	return TRUE;
+}
+
+// submit the batch being built without waiting, only once enough is
+// queued or it is old enough, so small batches keep accumulating
+static inline void _Viv2DStreamFlushPending(Viv2DPtr v2d) {
+	uint32_t queued = etna_cmd_stream_offset(v2d->stream);
+
+	if (queued == 0)
+		return;
+
+	if (queued >= VIV2D_FLUSH_QUEUED_WORDS ||
+	        GetTimeInMillis() - v2d->batch_start >= VIV2D_FLUSH_AGE_MS)
+		_Viv2DStreamCommit(v2d, TRUE);
+}
+
+#ifdef VIV2D_CACHED_PIXMAPS
+// keep the access counts of pix to its recent use
+static inline void _Viv2DPixAge(Viv2DPixmapPrivPtr pix) {
+	int count = pix->gpu_ops + pix->cpu_reads + pix->cpu_writes;
+
+#ifdef VIV2D_PLACEMENT
+	count += pix->gpu_misses;
+#endif
+	if (count > VIV2D_CACHED_WINDOW) {
+		pix->gpu_ops >>= 1;
+		pix->cpu_reads >>= 1;
+		pix->cpu_writes >>= 1;
+#ifdef VIV2D_PLACEMENT
+		pix->gpu_misses >>= 1;
+#endif
 	}
 }
+#endif
 
 static inline uint32_t Viv2DSrcConfig(Viv2DFormat *format) {
 	uint32_t src_cfg = VIVS_DE_SRC_CONFIG_SOURCE_FORMAT(format->fmt) |
@@ -199,18 +558,42 @@ static inline uint32_t Viv2DSrcConfig(Viv2DFormat *format) {
 	                   VIVS_DE_SRC_CONFIG_LOCATION_MEMORY |
 	                   VIVS_DE_SRC_CONFIG_PE10_SOURCE_FORMAT(format->fmt);
 
+	// mono rows are read as 32 bit words, leftmost pixel in the msb of
+	// the word, see Viv2DMonoExpand
+	if (format->fmt == DE_FORMAT_MONOCHROME)
+		src_cfg |= VIVS_DE_SRC_CONFIG_PACK_PACKED32 |
+		           VIVS_DE_SRC_CONFIG_MONO_TRANSPARENCY_BACKGROUND;
+
 	return src_cfg;
 }
 
 static inline void _Viv2DStreamSrcWithFormat(Viv2DPtr v2d, Viv2DPixmapPrivPtr src, Viv2DFormat *format) {
+	Viv2DState *st = &v2d->state;
+	uint32_t src_cfg = Viv2DSrcConfig(format);
+
+	src->batch = v2d->batch_serial;
+	st->src_pix = src;
+#ifdef VIV2D_CACHED_PIXMAPS
+	src->gpu_ops++;
+	_Viv2DPixAge(src);
+#endif
+
+	if ((st->valid & VIV2D_STATE_SRC) && st->src_bo == src->bo && st->src_offset == src->offset &&
+	        st->src_stride == src->pitch && st->src_config == src_cfg)
+		return;
 //	_Viv2DStreamReserve(v2d, 8);
 #if 1
-	etna_set_state_from_bo(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, ETNA_RELOC_READ);
+	etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, src->offset, ETNA_RELOC_READ);
 	etna_load_state(v2d->stream, VIVS_DE_SRC_STRIDE, 3);
 	etna_add_state(v2d->stream, src->pitch); // VIVS_DE_SRC_STRIDE
 	etna_add_state(v2d->stream, VIVS_DE_SRC_ROTATION_CONFIG_ROTATION_DISABLE); // VIVS_DE_SRC_ROTATION_CONFIG
-	etna_add_state(v2d->stream, Viv2DSrcConfig(format)); // VIVS_DE_SRC_CONFIG
+	etna_add_state(v2d->stream, src_cfg); // VIVS_DE_SRC_CONFIG
 #endif
+	st->src_bo = src->bo;
+	st->src_offset = src->offset;
+	st->src_stride = src->pitch;
+	st->src_config = src_cfg;
+	st->valid |= VIV2D_STATE_SRC;
 #if 0
 //	_Viv2DStreamReserve(v2d->stream, 12);
 	etna_set_state_from_bo(v2d->stream, VIVS_DE_SRC_ADDRESS, src->bo, ETNA_RELOC_READ);
@@ -234,16 +617,41 @@ static inline void _Viv2DStreamSrc(Viv2DPtr v2d, Viv2DPixmapPrivPtr src) {
 }
 
 static inline void _Viv2DStreamSrcOrigin(Viv2DPtr v2d, int srcX, int srcY, int width, int height) {
-	etna_set_state(v2d->stream, VIVS_DE_SRC_ORIGIN, VIVS_DE_SRC_ORIGIN_X(srcX) | VIVS_DE_SRC_ORIGIN_Y(srcY)); // VIVS_DE_SRC_ORIGIN
-	etna_set_state(v2d->stream, VIVS_DE_SRC_SIZE, VIVS_DE_SRC_SIZE_X(width) | VIVS_DE_SRC_SIZE_Y(height)); // VIVS_DE_SRC_SIZE
+	Viv2DState *st = &v2d->state;
+	uint32_t origin = VIVS_DE_SRC_ORIGIN_X(srcX) | VIVS_DE_SRC_ORIGIN_Y(srcY);
+	uint32_t size = VIVS_DE_SRC_SIZE_X(width) | VIVS_DE_SRC_SIZE_Y(height);
+
+	if ((st->valid & VIV2D_STATE_SRC_ORIGIN) && st->src_origin == origin && st->src_size == size)
+		return;
+
+	etna_set_state(v2d->stream, VIVS_DE_SRC_ORIGIN, origin); // VIVS_DE_SRC_ORIGIN
+	etna_set_state(v2d->stream, VIVS_DE_SRC_SIZE, size); // VIVS_DE_SRC_SIZE
+
+	st->src_origin = origin;
+	st->src_size = size;
+	st->valid |= VIV2D_STATE_SRC_ORIGIN;
 }
 
 
 static inline void _Viv2DStreamEmptySrc(Viv2DPtr v2d) {
+	Viv2DState *st = &v2d->state;
+
+	st->src_pix = NULL;
+	if ((st->valid & VIV2D_STATE_SRC) && st->src_bo == NULL &&
+	        st->src_stride == 0 && st->src_config == 0)
+		return;
+
 	etna_load_state(v2d->stream, VIVS_DE_SRC_STRIDE, 3);
 	etna_add_state(v2d->stream, 0); // VIVS_DE_SRC_STRIDE
 	etna_add_state(v2d->stream, 0); // VIVS_DE_SRC_ROTATION_CONFIG
 	etna_add_state(v2d->stream, 0); // VIVS_DE_SRC_CONFIG
+
+	// the address register is left as is, never match a real source
+	st->src_bo = NULL;
+	st->src_offset = 0;
+	st->src_stride = 0;
+	st->src_config = 0;
+	st->valid |= VIV2D_STATE_SRC;
 #if 0
 //	_Viv2DStreamReserve(v2d->stream, 10);
 //	etna_set_state(v2d->stream, VIVS_DE_SRC_ADDRESS, 0);
@@ -260,44 +668,67 @@ static inline void _Viv2DStreamEmptySrc(Viv2DPtr v2d) {
 #endif
 }
 
-static inline void _Viv2DStreamDst(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd, int rop, Viv2DRect *clip) {
-//	_Viv2DStreamReserve(v2d->stream, 14);
-#if 1
-	etna_set_state_from_bo(v2d->stream, VIVS_DE_DEST_ADDRESS, dst->bo, ETNA_RELOC_WRITE);
-	etna_load_state(v2d->stream, VIVS_DE_DEST_STRIDE, 3);
-	etna_add_state(v2d->stream, dst->pitch); // VIVS_DE_DEST_STRIDE
-	etna_add_state(v2d->stream, 0); // VIVS_DE_DEST_ROTATION_CONFIG
-	etna_add_state(v2d->stream,
-	               VIVS_DE_DEST_CONFIG_FORMAT(dst->format.fmt) |
-	               VIVS_DE_DEST_CONFIG_SWIZZLE(dst->format.swizzle) |
-	               cmd |
-	               VIVS_DE_DEST_CONFIG_TILED_DISABLE |
-	               VIVS_DE_DEST_CONFIG_MINOR_TILED_DISABLE
-	              ); // VIVS_DE_DEST_CONFIG
-
-	etna_load_state(v2d->stream, VIVS_DE_ROP, 3);
-	etna_add_state(v2d->stream,
-	               VIVS_DE_ROP_ROP_FG(rop) | VIVS_DE_ROP_ROP_BG(rop) | VIVS_DE_ROP_TYPE_ROP4); // VIVS_DE_ROP
+// rop_fg applies where a mono source has 1 bits, rop_bg where it has 0 bits,
+// other sources only use rop_fg
+static inline void _Viv2DStreamDstRop4(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd, int rop_fg, int rop_bg, Viv2DRect *clip) {
+	Viv2DState *st = &v2d->state;
+	uint32_t dst_cfg = VIVS_DE_DEST_CONFIG_FORMAT(dst->format.fmt) |
+	                   VIVS_DE_DEST_CONFIG_SWIZZLE(dst->format.swizzle) |
+	                   cmd |
+	                   VIVS_DE_DEST_CONFIG_TILED_DISABLE |
+	                   VIVS_DE_DEST_CONFIG_MINOR_TILED_DISABLE;
+	uint32_t rop_val = VIVS_DE_ROP_ROP_FG(rop_fg) | VIVS_DE_ROP_ROP_BG(rop_bg) | VIVS_DE_ROP_TYPE_ROP4;
+	uint32_t clip_tl, clip_br;
+
+	dst->batch = v2d->batch_serial;
+	st->dst_pix = dst;
+#ifdef VIV2D_SOLID_CACHE
+	dst->solid_known = FALSE;
+#endif
+#ifdef VIV2D_CACHED_PIXMAPS
+	dst->gpu_ops++;
+	_Viv2DPixAge(dst);
+#endif
 
 	if (clip) {
-		etna_add_state(v2d->stream,
-		               VIVS_DE_CLIP_TOP_LEFT_X(clip->x1) |
-		               VIVS_DE_CLIP_TOP_LEFT_Y(clip->y1)
-		              ); // VIVS_DE_CLIP_TOP_LEFT
-		etna_add_state(v2d->stream,
-		               VIVS_DE_CLIP_BOTTOM_RIGHT_X(clip->x2) |
-		               VIVS_DE_CLIP_BOTTOM_RIGHT_Y(clip->y2)
-		              ); // VIVS_DE_CLIP_BOTTOM_RIGHT
-
+		clip_tl = VIVS_DE_CLIP_TOP_LEFT_X(clip->x1) |
+		          VIVS_DE_CLIP_TOP_LEFT_Y(clip->y1);
+		clip_br = VIVS_DE_CLIP_BOTTOM_RIGHT_X(clip->x2) |
+		          VIVS_DE_CLIP_BOTTOM_RIGHT_Y(clip->y2);
 	} else {
-		etna_add_state(v2d->stream,
-		               VIVS_DE_CLIP_TOP_LEFT_X(0) |
-		               VIVS_DE_CLIP_TOP_LEFT_Y(0)
-		              ); // VIVS_DE_CLIP_TOP_LEFT
-		etna_add_state(v2d->stream,
-		               VIVS_DE_CLIP_BOTTOM_RIGHT_X(dst->width) |
-		               VIVS_DE_CLIP_BOTTOM_RIGHT_Y(dst->height)
-		              ); // VIVS_DE_CLIP_BOTTOM_RIGHT
+		clip_tl = VIVS_DE_CLIP_TOP_LEFT_X(0) |
+		          VIVS_DE_CLIP_TOP_LEFT_Y(0);
+		clip_br = VIVS_DE_CLIP_BOTTOM_RIGHT_X(dst->width) |
+		          VIVS_DE_CLIP_BOTTOM_RIGHT_Y(dst->height);
+	}
+//	_Viv2DStreamReserve(v2d->stream, 14);
+#if 1
+	if (!(st->valid & VIV2D_STATE_DST) || st->dst_bo != dst->bo || st->dst_offset != dst->offset ||
+	        st->dst_stride != dst->pitch || st->dst_config != dst_cfg) {
+		etna_set_state_from_bo_offset(v2d->stream, VIVS_DE_DEST_ADDRESS, dst->bo, dst->offset, ETNA_RELOC_WRITE);
+		etna_load_state(v2d->stream, VIVS_DE_DEST_STRIDE, 3);
+		etna_add_state(v2d->stream, dst->pitch); // VIVS_DE_DEST_STRIDE
+		etna_add_state(v2d->stream, 0); // VIVS_DE_DEST_ROTATION_CONFIG
+		etna_add_state(v2d->stream, dst_cfg); // VIVS_DE_DEST_CONFIG
+
+		st->dst_bo = dst->bo;
+		st->dst_offset = dst->offset;
+		st->dst_stride = dst->pitch;
+		st->dst_config = dst_cfg;
+		st->valid |= VIV2D_STATE_DST;
+	}
+
+	if (!(st->valid & VIV2D_STATE_ROP_CLIP) || st->rop != rop_val ||
+	        st->clip_tl != clip_tl || st->clip_br != clip_br) {
+		etna_load_state(v2d->stream, VIVS_DE_ROP, 3);
+		etna_add_state(v2d->stream, rop_val); // VIVS_DE_ROP
+		etna_add_state(v2d->stream, clip_tl); // VIVS_DE_CLIP_TOP_LEFT
+		etna_add_state(v2d->stream, clip_br); // VIVS_DE_CLIP_BOTTOM_RIGHT
+
+		st->rop = rop_val;
+		st->clip_tl = clip_tl;
+		st->clip_br = clip_br;
+		st->valid |= VIV2D_STATE_ROP_CLIP;
 	}
 #endif
 #if 0
@@ -341,7 +772,32 @@ static inline void _Viv2DStreamDst(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd
 
 }
 
+static inline void _Viv2DStreamDst(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, int cmd, int rop, Viv2DRect *clip) {
+	_Viv2DStreamDstRop4(v2d, dst, cmd, rop, rop, clip);
+}
+
+// colors 1 and 0 bits of a mono source expand to
+static inline void _Viv2DStreamMonoColor(Viv2DPtr v2d, uint32_t fg, uint32_t bg) {
+	Viv2DState *st = &v2d->state;
+
+	if ((st->valid & VIV2D_STATE_MONO_COLOR) && st->mono_fg == fg && st->mono_bg == bg)
+		return;
+
+	etna_load_state(v2d->stream, VIVS_DE_SRC_COLOR_BG, 2);
+	etna_add_state(v2d->stream, bg); // VIVS_DE_SRC_COLOR_BG
+	etna_add_state(v2d->stream, fg); // VIVS_DE_SRC_COLOR_FG
+	etna_cmd_stream_emit(v2d->stream, 0); // keep the next load state aligned
+
+	st->mono_fg = fg;
+	st->mono_bg = bg;
+	st->valid |= VIV2D_STATE_MONO_COLOR;
+}
+
 static inline void _Viv2DStreamBrushFill(Viv2DPtr v2d, uint32_t color) {
+	Viv2DState *st = &v2d->state;
+
+	if ((st->valid & VIV2D_STATE_PATTERN) && st->pattern_color == color)
+		return;
 //	_Viv2DStreamReserve(v2d, 10);
 	/*	etna_set_state(v2d->stream, VIVS_DE_PATTERN_MASK_LOW, 0xffffffff);
 		etna_set_state(v2d->stream, VIVS_DE_PATTERN_MASK_HIGH, 0xffffffff);
@@ -356,31 +812,51 @@ static inline void _Viv2DStreamBrushFill(Viv2DPtr v2d, uint32_t color) {
 	etna_add_state(v2d->stream, color);
 
 	etna_set_state(v2d->stream, VIVS_DE_PATTERN_CONFIG, VIVS_DE_PATTERN_CONFIG_INIT_TRIGGER(3));
+
+	st->pattern_color = color;
+	st->valid |= VIV2D_STATE_PATTERN;
 }
 
 
-static inline void _Viv2DStreamStretch(Viv2DPtr v2d, Viv2DPixmapPrivPtr src, Viv2DPixmapPrivPtr dst) {
+// stretch of a src_w x src_h area onto dst_w x dst_h
+static inline void _Viv2DStreamStretchFactor(Viv2DPtr v2d, int src_w, int src_h, int dst_w, int dst_h) {
+	Viv2DState *st = &v2d->state;
+	uint32_t low = VIVS_DE_STRETCH_FACTOR_LOW_X((src_w << 16) / dst_w);
+	uint32_t high = VIVS_DE_STRETCH_FACTOR_HIGH_Y((src_h << 16) / dst_h);
+
+	if ((st->valid & VIV2D_STATE_STRETCH) && st->stretch_low == low && st->stretch_high == high)
+		return;
 //	_Viv2DStreamReserve(v2d->stream, 4);
 
-	etna_set_state(v2d->stream, VIVS_DE_STRETCH_FACTOR_LOW,
-	               VIVS_DE_STRETCH_FACTOR_LOW_X(((src->width) << 16) / (dst->width)));
-	etna_set_state(v2d->stream, VIVS_DE_STRETCH_FACTOR_HIGH,
-	               VIVS_DE_STRETCH_FACTOR_HIGH_Y(((src->height) << 16) / (dst->height)));
-	VIV2D_OP_DBG_MSG("_Viv2DStreamStretch %dx%d / %dx%d", src->width, src->height, dst->width, dst->height);
+	etna_set_state(v2d->stream, VIVS_DE_STRETCH_FACTOR_LOW, low);
+	etna_set_state(v2d->stream, VIVS_DE_STRETCH_FACTOR_HIGH, high);
+
+	st->stretch_low = low;
+	st->stretch_high = high;
+	st->valid |= VIV2D_STATE_STRETCH;
+	VIV2D_OP_DBG_MSG("_Viv2DStreamStretch %dx%d / %dx%d", src_w, src_h, dst_w, dst_h);
 
 }
 
+static inline void _Viv2DStreamStretch(Viv2DPtr v2d, Viv2DPixmapPrivPtr src, Viv2DPixmapPrivPtr dst) {
+	_Viv2DStreamStretchFactor(v2d, src->width, src->height, dst->width, dst->height);
+}
+
 static inline void _Viv2DStreamRects(Viv2DPtr v2d, Viv2DRect *rects, int cur_rect) {
 	if (cur_rect > 0) {
-//		_Viv2DStreamReserve(v2d->stream, cur_rect * 2 + 2);
-		etna_cmd_stream_emit(v2d->stream,
-		                     VIV_FE_DRAW_2D_HEADER_OP_DRAW_2D |
-		                     VIV_FE_DRAW_2D_HEADER_COUNT(cur_rect)
-		                    );
-		etna_cmd_stream_emit(v2d->stream, 0x0); /* rectangles start aligned */
-
+//		_Viv2DStreamReserve(v2d->stream, VIV2D_RECTS_RES(cur_rect));
 		for (int i = 0; i < cur_rect; i++) {
 			Viv2DRect tmprect = rects[i];
+
+			if (i % VIV2D_DRAW_2D_MAX_RECTS == 0) {
+				int count = cur_rect - i < VIV2D_DRAW_2D_MAX_RECTS ? cur_rect - i : VIV2D_DRAW_2D_MAX_RECTS;
+				etna_cmd_stream_emit(v2d->stream,
+				                     VIV_FE_DRAW_2D_HEADER_OP_DRAW_2D |
+				                     VIV_FE_DRAW_2D_HEADER_COUNT(count)
+				                    );
+				etna_cmd_stream_emit(v2d->stream, 0x0); /* rectangles start aligned */
+			}
+
 			VIV2D_OP_DBG_MSG("_Viv2DStreamRects rect cur_rect:%d %dx%d:%dx%d", i, tmprect.x1, tmprect.y1, tmprect.x2, tmprect.y2);
 			etna_cmd_stream_emit(v2d->stream, VIV_FE_DRAW_2D_TOP_LEFT_X(tmprect.x1) |
 			                     VIV_FE_DRAW_2D_TOP_LEFT_Y(tmprect.y1));
@@ -395,8 +871,22 @@ static inline void _Viv2DStreamRects(Viv2DPtr v2d, Viv2DRect *rects, int cur_rec
 	VIV2D_OP_DBG_MSG("_Viv2DStreamRects %d", cur_rect);
 }
 
+static inline void _Viv2DStreamAlphaControl(Viv2DPtr v2d, uint32_t alpha_control) {
+	Viv2DState *st = &v2d->state;
+
+	if ((st->valid & VIV2D_STATE_ALPHA_CONTROL) && st->alpha_control == alpha_control)
+		return;
+
+	etna_set_state(v2d->stream, VIVS_DE_ALPHA_CONTROL, alpha_control);
+
+	st->alpha_control = alpha_control;
+	st->valid |= VIV2D_STATE_ALPHA_CONTROL;
+}
+
 static inline void _Viv2DStreamBlendOp(Viv2DPtr v2d, Viv2DBlendOp *blend_op,
                                        Bool src_global, uint8_t src_alpha, Bool dst_global, uint8_t dst_alpha) {
+	Viv2DState *st = &v2d->state;
+
 	if (blend_op) {
 		uint32_t alpha_mode = VIVS_DE_ALPHA_MODES_GLOBAL_SRC_ALPHA_MODE_NORMAL |
 		                      VIVS_DE_ALPHA_MODES_GLOBAL_DST_ALPHA_MODE_NORMAL;
@@ -419,22 +909,33 @@ static inline void _Viv2DStreamBlendOp(Viv2DPtr v2d, Viv2DBlendOp *blend_op,
 //			alpha_mode |= VIVS_DE_ALPHA_MODES_GLOBAL_DST_ALPHA_MODE_SCALED;
 		}
 
-//		_Viv2DStreamReserve(v2d->stream, 10);
-		etna_set_state(v2d->stream, VIVS_DE_ALPHA_CONTROL,
-		               VIVS_DE_ALPHA_CONTROL_ENABLE_ON |
-		               VIVS_DE_ALPHA_CONTROL_PE10_GLOBAL_SRC_ALPHA(src_alpha) |
-		               VIVS_DE_ALPHA_CONTROL_PE10_GLOBAL_DST_ALPHA(dst_alpha));
-
-		etna_set_state(v2d->stream, VIVS_DE_ALPHA_MODES,
-		               alpha_mode |
-		               VIVS_DE_ALPHA_MODES_SRC_BLENDING_MODE(blend_op->src_blend_mode) |
-		               VIVS_DE_ALPHA_MODES_DST_BLENDING_MODE(blend_op->dst_blend_mode));
+		alpha_mode |= VIVS_DE_ALPHA_MODES_SRC_BLENDING_MODE(blend_op->src_blend_mode) |
+		              VIVS_DE_ALPHA_MODES_DST_BLENDING_MODE(blend_op->dst_blend_mode);
 
-		etna_load_state(v2d->stream, VIVS_DE_GLOBAL_SRC_COLOR, 3);
-		etna_add_state(v2d->stream, src_alpha_color << 24); // VIVS_DE_GLOBAL_SRC_COLOR
-		etna_add_state(v2d->stream, dst_alpha_color << 24); // VIVS_DE_GLOBAL_DEST_COLOR
-		etna_add_state(v2d->stream, /* PE20 */
-		               premultiply); // VIVS_DE_COLOR_MULTIPLY_MODES
+//		_Viv2DStreamReserve(v2d->stream, 10);
+		_Viv2DStreamAlphaControl(v2d,
+		                         VIVS_DE_ALPHA_CONTROL_ENABLE_ON |
+		                         VIVS_DE_ALPHA_CONTROL_PE10_GLOBAL_SRC_ALPHA(src_alpha) |
+		                         VIVS_DE_ALPHA_CONTROL_PE10_GLOBAL_DST_ALPHA(dst_alpha));
+
+		if (!(st->valid & VIV2D_STATE_ALPHA) || st->alpha_modes != alpha_mode ||
+		        st->global_src_color != src_alpha_color << 24 ||
+		        st->global_dst_color != dst_alpha_color << 24 ||
+		        st->color_multiply != premultiply) {
+			etna_set_state(v2d->stream, VIVS_DE_ALPHA_MODES, alpha_mode);
+
+			etna_load_state(v2d->stream, VIVS_DE_GLOBAL_SRC_COLOR, 3);
+			etna_add_state(v2d->stream, src_alpha_color << 24); // VIVS_DE_GLOBAL_SRC_COLOR
+			etna_add_state(v2d->stream, dst_alpha_color << 24); // VIVS_DE_GLOBAL_DEST_COLOR
+			etna_add_state(v2d->stream, /* PE20 */
+			               premultiply); // VIVS_DE_COLOR_MULTIPLY_MODES
+
+			st->alpha_modes = alpha_mode;
+			st->global_src_color = src_alpha_color << 24;
+			st->global_dst_color = dst_alpha_color << 24;
+			st->color_multiply = premultiply;
+			st->valid |= VIV2D_STATE_ALPHA;
+		}
 
 
 #if 0
@@ -448,8 +949,7 @@ static inline void _Viv2DStreamBlendOp(Viv2DPtr v2d, Viv2DBlendOp *blend_op,
 
 	} else {
 //		_Viv2DStreamReserve(v2d->stream, 10);
-		etna_set_state(v2d->stream, VIVS_DE_ALPHA_CONTROL,
-		               VIVS_DE_ALPHA_CONTROL_ENABLE_OFF);
+		_Viv2DStreamAlphaControl(v2d, VIVS_DE_ALPHA_CONTROL_ENABLE_OFF);
 		/*		etna_set_state(v2d->stream, VIVS_DE_ALPHA_MODES, 0);
 				etna_set_state(v2d->stream, VIVS_DE_GLOBAL_SRC_COLOR, 0);
 				etna_set_state(v2d->stream, VIVS_DE_GLOBAL_DEST_COLOR, 0);
@@ -460,9 +960,15 @@ static inline void _Viv2DStreamBlendOp(Viv2DPtr v2d, Viv2DBlendOp *blend_op,
 }
 
 static inline void _Viv2DStreamColor(Viv2DPtr v2d, uint32_t color) {
+	Viv2DState *st = &v2d->state;
+
+	if ((st->valid & VIV2D_STATE_CLEAR_COLOR) && st->clear_color == color)
+		return;
 //	_Viv2DStreamReserve(v2d->stream, 8);
 	/* Clear color PE20 */
 	etna_set_state(v2d->stream, VIVS_DE_CLEAR_PIXEL_VALUE32, color );
+	st->clear_color = color;
+	st->valid |= VIV2D_STATE_CLEAR_COLOR;
 	/* Clear color PE10 */
 	/*	etna_set_state(v2d->stream, VIVS_DE_CLEAR_BYTE_MASK, 0xff);
 		etna_set_state(v2d->stream, VIVS_DE_CLEAR_PIXEL_VALUE_LOW, color);
@@ -479,7 +985,7 @@ static inline void _Viv2DStreamCacheFlush(Viv2DPtr v2d) {
 #endif
 }
 
-static inline void _Viv2DStreamReserveComp(Viv2DPtr v2d, int src_type, int cur_rect, Bool blend) {
+static inline Bool _Viv2DStreamReserveComp(Viv2DPtr v2d, int src_type, int cur_rect, Bool blend) {
 	int reserve = 0;
 	switch (src_type) {
 	case viv2d_src_stretch:
@@ -505,11 +1011,12 @@ static inline void _Viv2DStreamReserveComp(Viv2DPtr v2d, int src_type, int cur_r
 
 	reserve += VIV2D_CACHE_FLUSH_RES;
 
-	_Viv2DStreamReserve(v2d, reserve);
+	return _Viv2DStreamReserve(v2d, reserve);
 }
 
 static inline void _Viv2DStreamSolid(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, uint32_t color, Viv2DRect *rects, int cur_rect) {
-	_Viv2DStreamReserve(v2d, VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_SRC_SOLID_RES + VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(cur_rect) + VIV2D_CACHE_FLUSH_RES);
+	if (!_Viv2DStreamReserve(v2d, VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_SRC_SOLID_RES + VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(cur_rect) + VIV2D_CACHE_FLUSH_RES))
+		return;
 	_Viv2DStreamEmptySrc(v2d);
 	_Viv2DStreamSrcOrigin(v2d, 0, 0, 0, 0);
 	_Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_CLEAR, ROP_SRC, NULL);
@@ -520,7 +1027,8 @@ static inline void _Viv2DStreamSolid(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, uint3
 }
 
 static inline void _Viv2DStreamBrushSolid(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst, uint32_t color, Viv2DRect *rects, int cur_rect) {
-	_Viv2DStreamReserve(v2d, VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_SRC_BRUSH_FILL_RES + VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(cur_rect) + VIV2D_CACHE_FLUSH_RES);
+	if (!_Viv2DStreamReserve(v2d, VIV2D_DEST_RES + VIV2D_BLEND_OFF_RES + VIV2D_SRC_BRUSH_FILL_RES + VIV2D_SRC_EMPTY_RES + VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(cur_rect) + VIV2D_CACHE_FLUSH_RES))
+		return;
 	_Viv2DStreamEmptySrc(v2d);
 	_Viv2DStreamSrcOrigin(v2d, 0, 0, 0, 0);
 	_Viv2DStreamDst(v2d, dst, VIVS_DE_DEST_CONFIG_COMMAND_BIT_BLT, 0xf0, NULL);
@@ -530,14 +1038,12 @@ static inline void _Viv2DStreamBrushSolid(Viv2DPtr v2d, Viv2DPixmapPrivPtr dst,
 	_Viv2DStreamCacheFlush(v2d);
 }
 
-static inline void _Viv2DStreamCompAlpha(Viv2DPtr v2d, int src_type, Viv2DPixmapPrivPtr src, Viv2DFormat *src_fmt, int color,
+// emit the states of a composite pass, its rects follow
+static inline void _Viv2DStreamCompAlphaSetup(Viv2DPtr v2d, int src_type, Viv2DPixmapPrivPtr src, Viv2DFormat *src_fmt, int color,
         Viv2DPixmapPrivPtr dst, Viv2DBlendOp *blend_op,
         Bool src_global, uint8_t src_alpha,
         Bool dst_global, uint8_t dst_alpha,
-        int x, int y, int w, int h, Viv2DRect *rects, int cur_rect) {
-
-	Bool blend = blend_op != NULL ? TRUE : FALSE;
-	_Viv2DStreamReserveComp(v2d, src_type, cur_rect, blend);
+        int x, int y, int w, int h) {
 
 	switch (src_type) {
 	case viv2d_src_stretch:
@@ -566,6 +1072,20 @@ static inline void _Viv2DStreamCompAlpha(Viv2DPtr v2d, int src_type, Viv2DPixmap
 	}
 
 	_Viv2DStreamBlendOp(v2d, blend_op, src_global, src_alpha, dst_global, dst_alpha);
+}
+
+static inline void _Viv2DStreamCompAlpha(Viv2DPtr v2d, int src_type, Viv2DPixmapPrivPtr src, Viv2DFormat *src_fmt, int color,
+        Viv2DPixmapPrivPtr dst, Viv2DBlendOp *blend_op,
+        Bool src_global, uint8_t src_alpha,
+        Bool dst_global, uint8_t dst_alpha,
+        int x, int y, int w, int h, Viv2DRect *rects, int cur_rect) {
+
+	Bool blend = blend_op != NULL ? TRUE : FALSE;
+	if (!_Viv2DStreamReserveComp(v2d, src_type, cur_rect, blend))
+		return;
+
+	_Viv2DStreamCompAlphaSetup(v2d, src_type, src, src_fmt, color, dst, blend_op,
+	                           src_global, src_alpha, dst_global, dst_alpha, x, y, w, h);
 	_Viv2DStreamRects(v2d, rects, cur_rect);
 	_Viv2DStreamCacheFlush(v2d);
 }
@@ -577,15 +1097,17 @@ static inline void _Viv2DStreamComp(Viv2DPtr v2d, int src_type, Viv2DPixmapPrivP
 	_Viv2DStreamCompAlpha(v2d, src_type, src, src_fmt, color, dst, blend_op, FALSE, 0, FALSE, 0, x, y, w, h, rects, cur_rect);
 }
 
+// the PE cache is flushed once, at the end of the op
 static inline void _Viv2DStreamCompRects(Viv2DPtr v2d, int src_type, int x, int y, int w, int h, Viv2DRect *rects, int cur_rect) {
 	if (src_type == viv2d_src_stretch) {
-		_Viv2DStreamReserve(v2d, VIV2D_RECTS_RES(cur_rect) + VIV2D_CACHE_FLUSH_RES);
+		if (!_Viv2DStreamReserveOp(v2d, VIV2D_RECTS_RES(cur_rect)))
+			return;
 	} else {
-		_Viv2DStreamReserve(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(cur_rect) + VIV2D_CACHE_FLUSH_RES);
+		if (!_Viv2DStreamReserveOp(v2d, VIV2D_SRC_ORIGIN_RES + VIV2D_RECTS_RES(cur_rect)))
+			return;
 		_Viv2DStreamSrcOrigin(v2d, x, y, w, h);
 	}
 	_Viv2DStreamRects(v2d, rects, cur_rect);
-	_Viv2DStreamCacheFlush(v2d);
 }
 
 static inline void _Viv2DStreamClear(Viv2DPtr v2d, Viv2DPixmapPrivPtr pix) {
@@ -610,6 +1132,8 @@ static inline Viv2DPixmapPrivPtr _Viv2DOpCreateTmpPix(Viv2DPtr v2d, int width, i
 	int pitch;
 
 	tmp = calloc(sizeof(*tmp), 1);
+	if (!tmp)
+		return NULL;
 	pitch = ALIGN(width * ((bpp + 7) / 8), VIV2D_PITCH_ALIGN);
 	tmp->bo = etna_bo_cache_new(v2d->dev, pitch * height, ETNA_BO_WC);
 
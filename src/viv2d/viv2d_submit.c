@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2016 Julien Boulnois
+ * Copyright © 2020 Loongson Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ *    Sui Jingfeng <suijingfeng@loongson.cn>
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include <xorg-server.h>
+#include <xf86.h>
+
+#include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+#include "etnaviv_extra.h"
+
+#include "viv2d_submit.h"
+
+#ifdef VIV2D_SUBMIT_THREAD
+
+#ifdef ETNAVIV_CUSTOM
+#error "the submit worker needs the system libdrm_etnaviv"
+#endif
+
+#define SUBMIT_ERR_MSG(fmt, ...) \
+		do { xf86Msg(X_ERROR, fmt "\n",\
+				##__VA_ARGS__); } while (0)
+
+static void *Viv2DSubmitThread(void *arg)
+{
+	Viv2DSubmitQueue *q = arg;
+
+	for (;;) {
+		uint32_t tail = q->tail;
+		int slot = tail % VIV2D_STREAM_COUNT;
+
+		while (sem_wait(&q->work) == -1 && errno == EINTR)
+			;
+
+		// quit only once every handoff is submitted
+		if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&q->quit, __ATOMIC_ACQUIRE))
+				break;
+			continue;
+		}
+
+		q->rets[slot] = etna_cmd_stream_submit_ioctl(q->streams[slot], &q->reqs[slot]);
+
+		__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+		sem_post(&q->done);
+	}
+
+	return NULL;
+}
+
+Viv2DSubmitQueue *Viv2DSubmitQueueNew(void)
+{
+	Viv2DSubmitQueue *q = calloc(1, sizeof(*q));
+
+	if (!q)
+		return NULL;
+
+	sem_init(&q->work, 0, 0);
+	sem_init(&q->done, 0, 0);
+
+	if (pthread_create(&q->thread, NULL, Viv2DSubmitThread, q)) {
+		SUBMIT_ERR_MSG("Viv2DSubmitQueueNew: cannot create submit thread");
+		sem_destroy(&q->work);
+		sem_destroy(&q->done);
+		free(q);
+		return NULL;
+	}
+
+	return q;
+}
+
+void Viv2DSubmitQueueDel(Viv2DSubmitQueue *q)
+{
+	__atomic_store_n(&q->quit, 1, __ATOMIC_RELEASE);
+	sem_post(&q->work);
+	pthread_join(q->thread, NULL);
+
+	sem_destroy(&q->work);
+	sem_destroy(&q->done);
+	free(q);
+}
+
+// main thread only, the slot of this handoff must be finished.
+// with out_fence, the sync_file fd of the submit is in fence_fds once
+// the handoff is finished
+void Viv2DSubmitQueuePush(Viv2DSubmitQueue *q, struct etna_cmd_stream *stream, int out_fence)
+{
+	uint32_t head = q->head;
+	int slot = head % VIV2D_STREAM_COUNT;
+
+	q->streams[slot] = stream;
+	q->fence_fds[slot] = -1;
+	etna_cmd_stream_submit_prepare(stream, &q->reqs[slot], out_fence);
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	sem_post(&q->work);
+}
+
+// main thread only, block until count handoffs are submitted
+void Viv2DSubmitQueueWait(Viv2DSubmitQueue *q, uint32_t count)
+{
+	while ((int32_t)(Viv2DSubmitQueueTail(q) - count) < 0) {
+		while (sem_wait(&q->done) == -1 && errno == EINTR)
+			;
+	}
+}
+
+// main thread only, once the worker submitted slot: drop the stream bos,
+// record their fences and reset the stream for the next handoff
+void Viv2DSubmitQueueFinish(Viv2DSubmitQueue *q, int slot)
+{
+	struct drm_etnaviv_gem_submit *req = &q->reqs[slot];
+	int ret = q->rets[slot];
+
+	etna_cmd_stream_submit_done(q->streams[slot], req, ret);
+	q->fences[slot] = etna_cmd_stream_timestamp(q->streams[slot]);
+	if (!ret && (req->flags & ETNA_SUBMIT_FENCE_FD_OUT))
+		q->fence_fds[slot] = req->fence_fd;
+}
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2016 Julien Boulnois
+ * Copyright © 2020 Loongson Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * Authors:
+ *    Julien Boulnois <jboulnois@gmail.com>
+ *    Sui Jingfeng <suijingfeng@loongson.cn>
+ */
+
+#ifndef VIV2D_SUBMIT_H
+#define VIV2D_SUBMIT_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "etnaviv_drm.h"
+
+#include "viv2d_config.h"
+
+struct etna_cmd_stream;
+
+/*
+ * Streams handed off by the main thread are submitted by a worker thread,
+ * in order, through a single producer / single consumer ring. The ring has
+ * one entry per command stream slot, handoff n being slot n % VIV2D_STREAM_COUNT.
+ * The worker only does the submit ioctl: the request is prepared at handoff
+ * and the submit is finished by the main thread, the bos and the stream
+ * bookkeeping are never touched by the worker.
+ */
+typedef struct _Viv2DSubmitQueue {
+	pthread_t thread;
+	sem_t work; // posted by the main thread for each handoff
+	sem_t done; // posted by the worker for each submit
+
+	struct etna_cmd_stream *streams[VIV2D_STREAM_COUNT];
+	struct drm_etnaviv_gem_submit reqs[VIV2D_STREAM_COUNT]; // prepared at handoff
+	int rets[VIV2D_STREAM_COUNT]; // submit ioctl results, published by the worker with tail
+	uint32_t fences[VIV2D_STREAM_COUNT]; // set when the main thread finishes the submit
+	int fence_fds[VIV2D_STREAM_COUNT]; // out fence fd if asked at handoff, else -1
+
+	uint32_t head; // handoffs, written by the main thread
+	uint32_t tail; // submits, written by the worker
+	uint32_t retired; // submits the main thread finished
+	int quit;
+} Viv2DSubmitQueue;
+
+Viv2DSubmitQueue *Viv2DSubmitQueueNew(void);
+void Viv2DSubmitQueueDel(Viv2DSubmitQueue *q);
+void Viv2DSubmitQueuePush(Viv2DSubmitQueue *q, struct etna_cmd_stream *stream, int out_fence);
+void Viv2DSubmitQueueWait(Viv2DSubmitQueue *q, uint32_t count);
+void Viv2DSubmitQueueFinish(Viv2DSubmitQueue *q, int slot);
+
+static inline uint32_t Viv2DSubmitQueueTail(Viv2DSubmitQueue *q)
+{
+	return __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif